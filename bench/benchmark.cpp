@@ -0,0 +1,303 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include <eset.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+/*
+    Benchmarks of the common operations at different entity counts.
+    The results are printed as JSON, one object per benchmark and size:
+
+    eset_bench [--sizes 10000,1000000,10000000] [--filter name]
+
+    Everything random uses a fixed seed, so every run does the same work.
+    Peak RSS is the peak of the whole process so far, so it only grows
+    from one benchmark to the next.
+*/
+
+template<size_t N>
+struct Component {
+    float value;
+};
+
+struct Position {
+    float x, y, z;
+};
+
+struct Velocity {
+    float x, y, z;
+};
+
+struct Health {
+    int value;
+};
+
+template<size_t N>
+struct Fragment {
+    int value;
+};
+
+//the result of the timed part of a benchmark
+struct Measurement {
+    size_t operations;
+    double seconds;
+};
+
+struct Benchmark {
+    std::string name;
+    std::function<Measurement(size_t)> run;
+};
+
+//keeps the compiler from optimizing away the work that is measured
+static volatile float sink = 0.0f;
+
+using Clock = std::chrono::steady_clock;
+
+static double seconds_since(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static size_t peak_rss_kilobytes() {
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+    return counters.PeakWorkingSetSize / 1024;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+}
+
+Measurement create_destroy_churn(size_t count) {
+    eset::Set set;
+    std::vector<eset::Entity> entities = set.create_many<Position>(count, {});
+    std::mt19937_64 random(42);
+
+    //replace a random entity with a new one, count times
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < count; i++) {
+        size_t index = random() % count;
+        set.remove(entities[index]);
+        eset::Entity entity = set.create();
+        set.insert<Position>(entity, {1.0f, 2.0f, 3.0f});
+        entities[index] = entity;
+    }
+    return {count, seconds_since(start)};
+}
+
+Measurement insert_single(size_t count) {
+    eset::Set set;
+    std::vector<eset::Entity> entities = set.create_many<>(count);
+
+    Clock::time_point start = Clock::now();
+    for(eset::Entity entity : entities) {
+        set.insert<Position>(entity, {1.0f, 2.0f, 3.0f});
+    }
+    return {count, seconds_since(start)};
+}
+
+Measurement insert_multi(size_t count) {
+    eset::Set set;
+    std::vector<eset::Entity> entities = set.create_many<>(count);
+
+    Clock::time_point start = Clock::now();
+    for(eset::Entity entity : entities) {
+        set.insert<Position, Velocity, Health>(entity, {1.0f, 2.0f, 3.0f}, {}, {100});
+    }
+    return {count, seconds_since(start)};
+}
+
+Measurement get_raw_random(size_t count) {
+    eset::Set set;
+    std::vector<eset::Entity> entities = set.create_many<Position, Velocity>(count, {1.0f, 2.0f, 3.0f}, {});
+    std::shuffle(entities.begin(), entities.end(), std::mt19937_64(42));
+
+    Clock::time_point start = Clock::now();
+    float sum = 0.0f;
+    for(eset::Entity entity : entities) {
+        sum += set.get_raw<Position>(entity)->x;
+    }
+    sink = sum;
+    return {count, seconds_since(start)};
+}
+
+template<size_t... N>
+Measurement iterate(size_t count, std::index_sequence<N...>) {
+    eset::Set set;
+    set.create_many<Component<N>...>(count, Component<N>{1.0f}...);
+
+    Clock::time_point start = Clock::now();
+    float sum = 0.0f;
+    for(auto row : set.iterator<Component<N>...>()) {
+        sum += (std::get<N + 1>(row).value + ...);
+    }
+    sink = sum;
+    return {count, seconds_since(start)};
+}
+
+Measurement ref_access(size_t count) {
+    eset::Set set;
+    std::vector<eset::Entity> entities = set.create_many<Position>(count, {1.0f, 2.0f, 3.0f});
+
+    //reference every tenth entity, then move all of them so the references have to follow
+    std::vector<eset::Ref<Position>> refs;
+    for(size_t i = 0; i < count; i += 10) {
+        refs.push_back(set.get<Position>(entities[i]));
+    }
+    set.insert_many<Health>(entities, {100});
+
+    Clock::time_point start = Clock::now();
+    float sum = 0.0f;
+    for(eset::Ref<Position>& ref : refs) {
+        sum += ref->x;
+    }
+    sink = sum;
+    return {refs.size(), seconds_since(start)};
+}
+
+Measurement ref_churn(size_t count) {
+    eset::Set set;
+    std::vector<eset::Entity> entities = set.create_many<Position>(count, {1.0f, 2.0f, 3.0f});
+
+    //take a reference to every entity and drop it right away
+    Clock::time_point start = Clock::now();
+    float sum = 0.0f;
+    for(eset::Entity entity : entities) {
+        sum += set.get<Position>(entity)->x;
+    }
+    sink = sum;
+    return {count, seconds_since(start)};
+}
+
+template<size_t... Bit>
+void fragment(eset::Set& set, std::vector<eset::Entity>& entities, std::index_sequence<Bit...>) {
+
+    //every entity gets the fragments of the bits in its index, which spreads them over 2^bits archetypes
+    auto fragment_bit = [&](auto bit) {
+        std::vector<eset::Entity> chosen;
+        for(size_t i = 0; i < entities.size(); i++) {
+            if(i & (1 << bit.value)) {
+                chosen.push_back(entities[i]);
+            }
+        }
+        set.insert_many<Fragment<bit.value>>(chosen, {1});
+    };
+    (fragment_bit(std::integral_constant<size_t, Bit>{}), ...);
+}
+
+Measurement fragmented_iteration(size_t count) {
+    eset::Set set;
+    std::vector<eset::Entity> entities = set.create_many<Position>(count, {1.0f, 2.0f, 3.0f});
+    fragment(set, entities, std::make_index_sequence<9>{});
+
+    Clock::time_point start = Clock::now();
+    float sum = 0.0f;
+    for(auto [entity, position] : set.iterator<Position>()) {
+        sum += position.x;
+    }
+    sink = sum;
+    return {count, seconds_since(start)};
+}
+
+Measurement fragmented_churn(size_t count) {
+    eset::Set set;
+    std::vector<eset::Entity> entities = set.create_many<Position>(count, {1.0f, 2.0f, 3.0f});
+    fragment(set, entities, std::make_index_sequence<9>{});
+    std::mt19937_64 random(42);
+
+    //move random entities back and forth between the archetypes
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < count; i++) {
+        eset::Entity entity = entities[random() % count];
+        if(!set.remove_component<Fragment<0>>(entity)) {
+            set.insert<Fragment<0>>(entity, {1});
+        }
+    }
+    return {count, seconds_since(start)};
+}
+
+static std::vector<size_t> parse_sizes(const std::string& text) {
+    std::vector<size_t> sizes;
+    size_t start = 0;
+    while(start < text.size()) {
+        size_t end = text.find(',', start);
+        if(end == std::string::npos) {
+            end = text.size();
+        }
+        sizes.push_back(std::stoull(text.substr(start, end - start)));
+        start = end + 1;
+    }
+    return sizes;
+}
+
+int main(int argc, char** argv) {
+
+    std::vector<size_t> sizes = {10000, 1000000, 10000000};
+    std::string filter;
+    for(int i = 1; i + 1 < argc; i += 2) {
+        std::string argument = argv[i];
+        if(argument == "--sizes") {
+            sizes = parse_sizes(argv[i + 1]);
+        } else if(argument == "--filter") {
+            filter = argv[i + 1];
+        } else {
+            std::cerr << "unknown argument " << argument << "\n";
+            return 1;
+        }
+    }
+
+    std::vector<Benchmark> benchmarks = {
+        {"create_destroy_churn", create_destroy_churn},
+        {"insert_single", insert_single},
+        {"insert_multi", insert_multi},
+        {"get_raw_random", get_raw_random},
+        {"iterate_1", [](size_t count) { return iterate(count, std::make_index_sequence<1>{}); }},
+        {"iterate_3", [](size_t count) { return iterate(count, std::make_index_sequence<3>{}); }},
+        {"iterate_8", [](size_t count) { return iterate(count, std::make_index_sequence<8>{}); }},
+        {"ref_access", ref_access},
+        {"ref_churn", ref_churn},
+        {"fragmented_iteration", fragmented_iteration},
+        {"fragmented_churn", fragmented_churn},
+    };
+
+    std::cout << "[\n";
+    bool first = true;
+    for(Benchmark& benchmark : benchmarks) {
+        if(benchmark.name.find(filter) == std::string::npos) {
+            continue;
+        }
+        for(size_t size : sizes) {
+            Measurement measurement = benchmark.run(size);
+
+            //too few entities for the benchmark to do anything
+            if(measurement.operations == 0) {
+                continue;
+            }
+            double nanoseconds = measurement.seconds * 1e9 / measurement.operations;
+            std::cout << (first ? "" : ",\n")
+                      << "  {\"name\": \"" << benchmark.name << "\", \"entities\": " << size
+                      << ", \"operations\": " << measurement.operations
+                      << ", \"ns_per_op\": " << nanoseconds
+                      << ", \"ops_per_s\": " << (size_t)(measurement.operations / measurement.seconds)
+                      << ", \"peak_rss_kb\": " << peak_rss_kilobytes() << "}" << std::flush;
+            first = false;
+        }
+    }
+    std::cout << "\n]\n";
+    return 0;
+}
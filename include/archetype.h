@@ -2,6 +2,8 @@
 #include <unordered_map>
 #include <vector>
 #include <array>
+#include <span>
+#include <algorithm>
 #include <cstring>
 #include "component_storage.h"
 #include "types.h"
@@ -11,73 +13,106 @@ namespace eset {
 
     class Archetype;
     class Set;
-
-    class ArchetypeSignature {
-
-        public:
-            ArchetypeSignature() = default;
-            size_t count();
-            void add(size_t id, size_t size);
-            bool operator==(ArchetypeSignature& rhs);
-            bool contains(ArchetypeSignature& other);
-
-        private:
-            friend Archetype;
-            size_t m_count = 0;
-            size_t m_ids[32];
-            size_t m_sizes[32];
-    };
-
+    class CommandBuffer;
+
+    /*
+        A set of component ids, stored as a bitset of 64 bit words.
+        The amount of ids and a hash are kept up to date while adding,
+        so counting and hashing are free, and comparing and matching
+        signatures are a few word wide ANDs the compiler can vectorize.
+    */
     class FastSignature {
 
         public:
+            static constexpr size_t word_count = MAX_COMPONENTS / 64;
+
             FastSignature() {
-                memset(m_ids, 0, MAX_COMPONENTS/8);
+                clear();
             };
-            
-            size_t count();
+
+            inline size_t count() const {
+                return m_count;
+            }
 
             inline void clear() {
-                memset(m_ids, 0, MAX_COMPONENTS/8);
+                memset(m_words, 0, sizeof(m_words));
+                m_count = 0;
+                m_hash = 0;
             }
-            
+
             inline void add(size_t id) {
-                size_t segment = id / 8;
-                size_t rest = id - (segment*8);
-                m_ids[segment] = m_ids[segment] | (1 << rest);
-                m_count++;
+                uint64_t bit = 1ull << (id % 64);
+                uint64_t& word = m_words[id / 64];
+                if(!(word & bit)) {
+                    word |= bit;
+                    m_count++;
+
+                    //mix the id before summing, so the hash is order independent but still well spread
+                    uint64_t mixed = id + 0x9E3779B97F4A7C15ull;
+                    mixed = (mixed ^ (mixed >> 30)) * 0xBF58476D1CE4E5B9ull;
+                    mixed = (mixed ^ (mixed >> 27)) * 0x94D049BB133111EBull;
+                    m_hash += mixed ^ (mixed >> 31);
+                }
             }
 
-            inline bool contains(FastSignature& other) {
+            inline bool contains(const FastSignature& other) const {
                 if(m_count < other.m_count) {
                     return false;
                 }
 
-                for(size_t i = 0; i < MAX_COMPONENTS / 8; i++) {
-                    if((m_ids[i] & other.m_ids[i]) != other.m_ids[i]) {
-                        return false;
-                    }
+                uint64_t missing = 0;
+                for(size_t i = 0; i < word_count; i++) {
+                    missing |= other.m_words[i] & ~m_words[i];
                 }
-                return true;
+                return missing == 0;
             }
 
-            inline bool contains(size_t id) {
-                size_t segment = id / 8;
-                size_t rest = id - (segment*8);
-                return ((m_ids[segment] | (1 << rest)) == m_ids[segment]);
+            inline bool contains(size_t id) const {
+                return (m_words[id / 64] >> (id % 64)) & 1;
             }
 
-        private:
-            size_t m_count = 0;
-            uint8_t m_ids[MAX_COMPONENTS / 8];
+            /*
+                Returns true if any component id
+                exists in both signatures.
+            */
+            inline bool intersects(const FastSignature& other) const {
+                uint64_t shared = 0;
+                for(size_t i = 0; i < word_count; i++) {
+                    shared |= m_words[i] & other.m_words[i];
+                }
+                return shared != 0;
+            }
+
+            inline bool operator==(const FastSignature& rhs) const {
+                return m_count == rhs.m_count && m_hash == rhs.m_hash && memcmp(m_words, rhs.m_words, sizeof(m_words)) == 0;
+            }
+
+            /*
+                Returns a hash of the component ids, so signatures
+                can be used as keys. The hash doesn't depend on the order
+                the ids were added in, so equal signatures share it.
+            */
+            inline size_t hash() const {
+                return m_hash;
+            }
+
+            struct Hasher {
+                size_t operator()(const FastSignature& signature) const {
+                    return signature.hash();
+                }
+            };
 
+        private:
+            uint64_t m_words[word_count];
+            size_t m_count;
+            size_t m_hash;
     };
 
     class Archetype {
         public:
 
             Archetype() = default;
-            Archetype(std::vector<BaseStorage*>& storage_pointers);
+            Archetype(std::vector<BaseStorage*>& storage_pointers, const std::vector<size_t>& tag_ids = {});
             ~Archetype();
 
             /*
@@ -90,41 +125,63 @@ namespace eset {
             Archetype(Archetype&& other);
 
             /*
-                Provides an entity index and a type argument
+                Provides an entity's offset and a type argument
                 to then return that component data
             */
             template<typename T>
-            inline T* get_component(Entity entity) {
+            inline T* get_component(size_t offset) {
 
                 //get the component index
                 size_t component_index = Types::type_id<T>(); 
 
                 //check if the component exist here
-                if(has_component<T>()) {
+                if(!has_component<T>()) {
 
-                    //the component did exist! Return it.
-                    size_t offset = entity_to_offset[entity];
-                    return (T*)(compound[component_index]->get_component_pointer(offset));
-                } else {
-                    
                     //the component doesn't exist, return nullptr.
                     return nullptr;
+                } else if constexpr(is_tag<T>) {
+
+                    //tags have no storage, every entity shares the same instance
+                    return &tag_instance<T>();
+                } else {
+
+                    //the component did exist! Return it.
+                    return (T*)(compound[component_index]->get_component_pointer(offset));
                 }
             }
 
             /*
-                Removes an entity from this archetype and it's corresponding components.
+                Removes the entity at the given offset from this archetype and it's corresponding components.
                 Under the hood it will swap with the last entity that was added.
                 This shouldn't really be used by the user, since removing a nonexistant 
                 entity will give undefined behaviour.
+                References to the removed components become invalid, and the ones to
+                the swapped components follow them. No signals are emitted, the
+                set does that before the entity is removed.
+                Returns the entity that was swapped into the offset, or eset::null
+                if the removed entity was the last one.
+            */
+            Entity remove_entity(size_t offset);
+
+            /*
+                Removes the rows at the given offsets, which must be sorted and unique,
+                without emitting signals. The holes are filled with the rows at the end,
+                moved a run at a time, and the set's entity slots are updated.
+                Returns the amount of rows that were moved into holes.
             */
-            void remove_entity(Entity entity, Set* set);
+            size_t remove_rows(const std::vector<size_t>& offsets, Set* set);
 
             /*
-                Initializes an entity inside the Archetype.
+                Initializes an entity inside the Archetype and returns its offset.
                 The data isn't set here, so it needs to be set exactly after this.
             */
-            void insert_entity(Entity entity);
+            size_t insert_entity(Entity entity);
+
+            /*
+                Makes room for count more entities in every storage,
+                so inserting them doesn't reallocate.
+            */
+            void reserve(size_t count);
 
             /*
                 Checks if this Archetype has a certain component.
@@ -132,19 +189,13 @@ namespace eset {
             */
             template<typename T>
             inline bool has_component() {
-                if(fast_signature.contains(Types::type_id<T>())) {
-                    return compound[Types::type_id<T>()]->get_component_size() != 0;
-                } else {
-                    return false;
-                }
+                return fast_signature.contains(Types::type_id<T>());
             }
 
             /*
-                Returns an array containing all the
+                Returns the signature of all the
                 different type's ids.
             */
-            ArchetypeSignature get_archetype_signature();
-
             FastSignature get_fast_signature();
 
             inline size_t count() {
@@ -160,18 +211,49 @@ namespace eset {
                 return compound[Types::type_id<T>()]->get_component_pointer(offset);
             }
 
+            /*
+                Calls the function with spans of the entities and the
+                given components for the offsets between begin and end.
+                The range is split up where any of the components stops
+                being contiguous in memory, so the function can be called
+                more than once.
+            */
+            template<typename... Ts, typename Function>
+            void for_each_run(size_t begin, size_t end, Function& function) {
+                static_assert((!is_tag<Ts> && ...), "tags have no columns, filter on them with an iterator or a query");
+                while(begin < end) {
+                    size_t run_end = end;
+                    ((run_end = std::min(run_end, begin + compound[Types::type_id<Ts>()]->contiguous_count(begin))), ...);
+                    size_t length = run_end - begin;
+                    function(std::span<const Entity>(offset_to_entity.data() + begin, length),
+                             std::span<Ts>((Ts*)compound[Types::type_id<Ts>()]->get_component_pointer(begin), length)...);
+                    begin = run_end;
+                }
+            }
+
         private:
 
             friend Set;
+            friend CommandBuffer;
             template<typename...> friend class EntityIterator;
 
-            //these are all the entities that have this archetype
-            std::unordered_map<Entity, size_t> entity_to_offset;
+            //these are all the entities that have this archetype.
+            //the set keeps track of each entity's offset.
             std::vector<Entity> offset_to_entity;
 
+            //cached transitions to other archetypes, keyed by the component type id
+            //that is added or removed. The values are indices into Set::archetypes.
+            std::unordered_map<size_t, size_t> add_edges;
+            std::unordered_map<size_t, size_t> remove_edges;
+
             //the entities' data
+            //the storages indexed by component id. Only as long as the highest id in
+            //the archetype, and only the ids in the signature may be looked up.
             std::vector<size_t> compound_indices;
-            BaseStorage* compound[MAX_COMPONENTS];
+            std::vector<BaseStorage*> compound;
             FastSignature fast_signature;
+
+            //the tags, which are only in the signature
+            std::vector<size_t> tag_indices;
     };
 }
\ No newline at end of file
@@ -0,0 +1,166 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include "component_storage.h"
+#include "types.h"
+
+namespace eset {
+
+    class Set;
+
+    /*
+        Records structural changes, so they can be applied to a set
+        later in one batch. Useful while iterating over a set, since
+        creating, removing or changing the components of entities
+        in the middle of an iteration invalidates it.
+
+        A command buffer is not thread safe, but nothing is shared
+        between buffers, so every thread can record into its own
+        buffer without locking, and the buffers are flushed afterwards.
+
+        eset::CommandBuffer commands;
+        for(auto [entity, health] : set.iterator<Health>()) {
+            if(health.value <= 0) {
+                commands.remove(entity);
+            }
+        }
+        commands.flush(set);
+    */
+    class CommandBuffer {
+        public:
+
+            CommandBuffer() = default;
+            ~CommandBuffer();
+
+            //the buffer owns the recorded components, so it can't be copied
+            CommandBuffer(const CommandBuffer&) = delete;
+            CommandBuffer& operator=(const CommandBuffer&) = delete;
+
+            /*
+                Records the creation of an entity. The returned entity is a
+                placeholder that can only be used with this buffer, until
+                flush returns the real entity.
+            */
+            Entity create();
+
+            /*
+                Records inserting one or more components into an entity.
+                The components are moved into the buffer until it's flushed.
+            */
+            template<typename... Ts>
+            void insert(Entity entity, Ts... components) {
+                static_assert(sizeof...(Ts) > 0, "insert needs at least one component");
+                ((commands.push_back({CommandType::INSERT, entity, make_pending<Ts>(std::move(components))})), ...);
+            }
+
+            /*
+                Records removing a component from an entity.
+            */
+            template<typename T>
+            void remove_component(Entity entity) {
+                PendingComponent component = {};
+                component.id = Types::type_id<T>();
+                commands.push_back({CommandType::REMOVE_COMPONENT, entity, component});
+            }
+
+            /*
+                Records removing an entity.
+            */
+            void remove(Entity entity);
+
+            /*
+                Applies every recorded command to the set and empties the buffer.
+                The commands of each entity are combined first, so an entity is
+                moved to another archetype at most once, and the entities are
+                applied grouped by the archetype they end up in.
+                Returns the real entities of every create call, in order. An entity
+                that was both created and removed by the buffer is eset::null.
+                Ends with Set::flush_observers, so batch observers get the
+                whole buffer in one call per component type.
+            */
+            std::vector<Entity> flush(Set& set);
+
+            /*
+                Throws away every recorded command.
+            */
+            void clear();
+
+            /*
+                Returns the amount of recorded commands.
+            */
+            size_t size();
+
+        private:
+
+            enum class CommandType {
+                CREATE,
+                INSERT,
+                REMOVE_COMPONENT,
+                REMOVE
+            };
+
+            /*
+                A component waiting to be inserted, together with how to
+                destroy it without knowing its type. The rest of what is
+                needed to store it comes from Types::info.
+            */
+            struct PendingComponent {
+                size_t id;
+                void* value;
+                void (*destroy)(void*);
+            };
+
+            struct Command {
+                CommandType type;
+                Entity entity;
+                PendingComponent component;
+            };
+
+            /*
+                What the commands of a single entity add up to.
+                Holds at most one pending component per type, and never
+                a component that is also in the removed ids.
+            */
+            struct EntityPlan {
+                EntityPlan(Entity entity) : entity(entity) {}
+
+                Entity entity;
+                bool removed = false;
+                std::vector<PendingComponent> inserts;
+                std::vector<size_t> removed_ids;
+                size_t destination = -1;
+
+                //the components the entity didn't have before, for the insert observers
+                std::vector<size_t> inserted_ids;
+            };
+
+            /*
+                Returns the index of the archetype the entity ends up in when
+                the plan is applied to it in the source archetype, creating it
+                if needed. Drops removed ids that the source doesn't have.
+            */
+            size_t destination_archetype(Set& set, size_t source_index, EntityPlan& plan);
+
+            /*
+                Creates or moves the entity of the plan into its destination
+                and stores its pending components there. Calls no observers,
+                so the destinations of the other plans stay right.
+            */
+            void apply(Set& set, EntityPlan& plan);
+
+            template<typename T>
+            static PendingComponent make_pending(T&& value) {
+                PendingComponent component;
+                component.id = Types::type_id<T>();
+                component.value = new T(std::move(value));
+                component.destroy = [](void* value) { delete (T*)value; };
+                return component;
+            }
+
+            std::vector<Command> commands;
+
+            //placeholders use the null index, which no real entity has,
+            //and count the creations in their generation
+            uint32_t created_count = 0;
+    };
+}
@@ -1,9 +1,16 @@
 #pragma once
 #include "types.h"
 #include <vector>
+#include <new>
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <type_traits>
 
 namespace eset {
 
+    struct ReferenceData;
+
     class BaseStorage {
         public:
         
@@ -12,18 +19,6 @@ namespace eset {
             */
             virtual void* get_component_pointer(uint64_t offset) = 0;
 
-            /*
-                Get the pointer at the end of the storage
-            */
-            virtual void* get_last_component() = 0;
-
-            /*
-                Moves the last component to another offset.
-                Very useful when removing an entity's components from one
-                archetype.
-            */
-            virtual void move_from_end(uint64_t destination_offset) = 0;
-
             /*
                 Returns the size in bytes of this
                 component storage's component!
@@ -42,6 +37,14 @@ namespace eset {
             */
             virtual size_t get_component_count() = 0;
 
+            /*
+                Returns how many components, starting at the offset,
+                are laid out right after each other in memory.
+                Pointer arithmetic from the component at the offset
+                is valid for that many components.
+            */
+            virtual size_t contiguous_count(uint64_t offset) = 0;
+
             /*
                 Inserts data at the end of the storage.
             */
@@ -55,10 +58,48 @@ namespace eset {
             virtual void set_component(uint64_t offset, void* data_pointer) = 0;
 
             /*
-                Removes the last component.
-                In reality, it just decreases the component_count by one.
+                Moves the last component over the one at the offset and
+                removes the last one.
             */
-            virtual void remove_end() = 0;
+            virtual void swap_remove(uint64_t offset) = 0;
+
+            /*
+                Moves count components, starting at the offset of the source,
+                to the end of this storage. The source must be a storage of the
+                same component type, and keeps its size. Trivially copyable
+                components are copied in as few memcpy calls as possible.
+            */
+            virtual void push_back_range(BaseStorage* source, uint64_t offset, size_t count) = 0;
+
+            /*
+                Copies count components from raw bytes to the end of the storage.
+                Only for trivially copyable components, the data must be aligned
+                for the component type.
+            */
+            virtual void push_back_bytes(const void* data, size_t count) = 0;
+
+            /*
+                Moves count components inside the storage from the source
+                offset to the destination offset. The ranges must not overlap.
+            */
+            virtual void move_range(uint64_t destination, uint64_t source, size_t count) = 0;
+
+            /*
+                Removes components from the end until count are left.
+            */
+            virtual void truncate(size_t count) = 0;
+
+            /*
+                Returns the amount of components the storage
+                has room for without allocating.
+            */
+            virtual size_t capacity() = 0;
+
+            /*
+                Makes room for at least count components,
+                so pushing up to that many doesn't reallocate.
+            */
+            virtual void reserve(size_t count) = 0;
 
             /*
                 Makes a copy of a component storage.
@@ -75,20 +116,112 @@ namespace eset {
             virtual ~BaseStorage() = default;
 
             /*
-                Returns a unique id of the storage
+                Adds the ticks of count components that were just
+                inserted at the end of the storage. The ticks, and the
+                references if there are any, are kept next to the
+                components, so they need to be pushed and removed
+                together with them.
+            */
+            void push_ticks(uint32_t added_tick, uint32_t changed_tick, size_t count = 1);
+
+            /*
+                Makes room for the ticks of at least count components.
             */
-            uint16_t storage_id();
+            void reserve_ticks(size_t count);
 
             /*
-                Combines the storage id with an offset to
-                get a unique identifier used for the 
-                reference
+                The tick and reference counterparts of push_back_range,
+                move_range and truncate. Copies the ticks of the source,
+                but not its references, which the set moves itself.
+                References follow move_ticks, and the ones removed by
+                truncate_ticks must already be cleared.
             */
-            uint64_t storage_offset_identifier(uint64_t offset);
+            void push_ticks_from(BaseStorage* source, uint64_t offset, size_t count);
+
+            /*
+                Adds the given ticks of count components that were
+                just inserted at the end of the storage.
+            */
+            void push_ticks(const uint32_t* added_ticks, const uint32_t* changed_ticks, size_t count);
+
+            /*
+                Returns the bytes used and reserved by the ticks and references.
+            */
+            size_t bookkeeping_bytes();
+            size_t bookkeeping_capacity_bytes();
+            void move_ticks(uint64_t destination, uint64_t source, size_t count);
+            void truncate_ticks(size_t count);
+
+            /*
+                Moves the ticks and reference at the end to the offset and removes the
+                last ones, the same way swap_remove does with the components.
+                The component at the offset must not have a reference anymore.
+            */
+            void remove_ticks(uint64_t offset);
+
+            /*
+                Marks the component at the offset as changed at the tick.
+            */
+            void set_changed_tick(uint64_t offset, uint32_t tick);
+
+            /*
+                Returns the tick the component at the offset was
+                added at, and the tick it was last changed at.
+            */
+            uint32_t added_tick(uint64_t offset);
+            uint32_t changed_tick(uint64_t offset);
+
+            /*
+                Returns the ticks of every component, by offset.
+            */
+            const uint32_t* added_ticks();
+            const uint32_t* changed_ticks();
+
+            /*
+                Returns the latest tick any component in this storage
+                was added or changed at. Lets whole storages be skipped
+                when nothing has happened to them.
+            */
+            uint32_t last_added_tick();
+            uint32_t last_changed_tick();
+
+            /*
+                Returns the reference data of the component at the
+                offset, or nullptr if it isn't referenced.
+            */
+            inline ReferenceData* reference(uint64_t offset) {
+                return m_references.empty() ? nullptr : m_references[offset];
+            }
+
+            /*
+                Sets or clears the reference data of the component at the offset.
+                The data itself isn't changed.
+            */
+            void set_reference(uint64_t offset, ReferenceData* reference_data);
+
+            /*
+                Returns true if any component in this storage is referenced.
+            */
+            inline bool has_references() {
+                return m_referenced_count != 0;
+            }
 
         protected:
-            static uint16_t m_storage_count;
-            uint16_t m_storage_id;
+            std::vector<uint32_t> m_added_ticks;
+            std::vector<uint32_t> m_changed_ticks;
+            uint32_t m_last_added_tick = 0;
+            uint32_t m_last_changed_tick = 0;
+
+            //the reference data of every component, by offset. Stays empty until a
+            //component in the storage is referenced, so rows that never had references
+            //cost nothing to move and remove. Once made, it's kept until the storage empties.
+            std::vector<ReferenceData*> m_references;
+            size_t m_referenced_count = 0;
+
+        private:
+
+            //frees the references once the storage has emptied
+            void release_references();
     };
 
     template<typename ComponentType>
@@ -96,23 +229,10 @@ namespace eset {
 
         public:
 
-            ComponentStorage() {
-                m_storage_id = m_storage_count;
-                m_storage_count++;
-            }
-
             void* get_component_pointer(uint64_t offset) {
                 return &components[offset];
             }
 
-            void* get_last_component() {
-                return &components[components.size() - 1];
-            }
-
-            void move_from_end(uint64_t destination_offset) {
-                components[destination_offset] = std::move(components.back());
-            }
-
             size_t get_component_size() {
                 return sizeof(ComponentType);
             }
@@ -121,6 +241,10 @@ namespace eset {
                 return components.size();
             }
 
+            size_t contiguous_count(uint64_t offset) {
+                return components.size() - offset;
+            }
+
             size_t get_component_type_id() {
                 return Types::type_id<ComponentType>();
             }
@@ -133,10 +257,56 @@ namespace eset {
                 components[offset] = std::move(*(ComponentType*)data_pointer);
             }
 
-            void remove_end() {
+            void swap_remove(uint64_t offset) {
+                if(offset + 1 != components.size()) {
+                    components[offset] = std::move(components.back());
+                }
                 components.pop_back();
             }
 
+            void push_back_range(BaseStorage* source, uint64_t offset, size_t count) {
+
+                //the storages of a component type are always of the same class, see StorageOf.
+                //for trivially copyable components both of these are a memmove
+                ComponentType* first = &((ComponentStorage*)source)->components[offset];
+                if constexpr(std::is_trivially_copyable_v<ComponentType>) {
+                    components.insert(components.end(), first, first + count);
+                } else {
+                    components.insert(components.end(), std::make_move_iterator(first), std::make_move_iterator(first + count));
+                }
+            }
+
+            void push_back_bytes(const void* data, size_t count) {
+                if constexpr(std::is_trivially_copyable_v<ComponentType>) {
+                    const ComponentType* first = (const ComponentType*)data;
+                    components.insert(components.end(), first, first + count);
+                }
+            }
+
+            void move_range(uint64_t destination, uint64_t source, size_t count) {
+                std::move(components.begin() + source, components.begin() + source + count, components.begin() + destination);
+            }
+
+            void truncate(size_t count) {
+                components.erase(components.begin() + count, components.end());
+            }
+
+            size_t capacity() {
+                return components.capacity();
+            }
+
+            void reserve(size_t count) {
+                components.reserve(count);
+            }
+
+            /*
+                Copy constructs count components from the prototype
+                at the end of the storage, reallocating at most once.
+            */
+            void push_back_copies(size_t count, const ComponentType& prototype) {
+                components.insert(components.end(), count, prototype);
+            }
+
             BaseStorage* make_empty_copy() {
                 return new ComponentStorage<ComponentType>();
             }
@@ -144,4 +314,183 @@ namespace eset {
         private:
             std::vector<ComponentType> components;
     };
+
+    /*
+        A component storage that keeps its components in fixed
+        size blocks of BlockSize components. The blocks are aligned
+        to at least 64 bytes and are never reallocated, so growing
+        the storage never moves the components that already exist.
+        Use it for a component type by specializing StorageType:
+
+        template<> struct eset::StorageType<Position> {
+            using type = eset::ChunkedStorage<Position>;
+        };
+    */
+    template<typename ComponentType, size_t BlockSize = 1024>
+    class ChunkedStorage : public BaseStorage {
+
+        public:
+
+            static constexpr size_t alignment = std::max<size_t>(64, alignof(ComponentType));
+
+            ~ChunkedStorage() {
+                while(count > 0) {
+                    remove_end();
+                }
+                for(ComponentType* block : blocks) {
+                    ::operator delete(block, std::align_val_t(alignment));
+                }
+            }
+
+            void* get_component_pointer(uint64_t offset) {
+                return &blocks[offset / BlockSize][offset % BlockSize];
+            }
+
+            size_t get_component_size() {
+                return sizeof(ComponentType);
+            }
+
+            size_t get_component_count() {
+                return count;
+            }
+
+            size_t contiguous_count(uint64_t offset) {
+                return std::min(BlockSize - offset % BlockSize, count - offset);
+            }
+
+            size_t get_component_type_id() {
+                return Types::type_id<ComponentType>();
+            }
+
+            void push_back(void* pointer) {
+                new (next_slot()) ComponentType(std::move(*(ComponentType*)pointer));
+                count++;
+            }
+
+            void set_component(uint64_t offset, void* data_pointer) {
+                at(offset) = std::move(*(ComponentType*)data_pointer);
+            }
+
+            void swap_remove(uint64_t offset) {
+                if(offset + 1 != count) {
+                    at(offset) = std::move(at(count - 1));
+                }
+                remove_end();
+            }
+
+            void push_back_range(BaseStorage* source, uint64_t offset, size_t count) {
+
+                //the storages of a component type are always of the same class, see StorageOf
+                ChunkedStorage* other = (ChunkedStorage*)source;
+                while(count > 0) {
+
+                    //copy up to the end of the current block on either side
+                    ComponentType* destination = next_slot();
+                    size_t run = std::min({count, BlockSize - this->count % BlockSize, BlockSize - offset % BlockSize});
+                    ComponentType* first = &other->at(offset);
+                    if constexpr(std::is_trivially_copyable_v<ComponentType>) {
+                        memcpy((void*)destination, first, run * sizeof(ComponentType));
+                    } else {
+                        for(size_t i = 0; i < run; i++) {
+                            new (destination + i) ComponentType(std::move(first[i]));
+                        }
+                    }
+                    this->count += run;
+                    offset += run;
+                    count -= run;
+                }
+            }
+
+            void push_back_bytes(const void* data, size_t count) {
+                if constexpr(std::is_trivially_copyable_v<ComponentType>) {
+                    const char* bytes = (const char*)data;
+                    while(count > 0) {
+                        size_t run = std::min(count, BlockSize - this->count % BlockSize);
+                        memcpy((void*)next_slot(), bytes, run * sizeof(ComponentType));
+                        this->count += run;
+                        bytes += run * sizeof(ComponentType);
+                        count -= run;
+                    }
+                }
+            }
+
+            void move_range(uint64_t destination, uint64_t source, size_t count) {
+                for(size_t i = 0; i < count; i++) {
+                    at(destination + i) = std::move(at(source + i));
+                }
+            }
+
+            void truncate(size_t count) {
+                while(this->count > count) {
+                    remove_end();
+                }
+            }
+
+            size_t capacity() {
+                return blocks.size() * BlockSize;
+            }
+
+            void reserve(size_t count) {
+                blocks.reserve((count + BlockSize - 1) / BlockSize);
+            }
+
+            /*
+                Copy constructs count components from the prototype
+                at the end of the storage.
+            */
+            void push_back_copies(size_t count, const ComponentType& prototype) {
+                blocks.reserve((this->count + count + BlockSize - 1) / BlockSize);
+                for(size_t i = 0; i < count; i++) {
+                    new (next_slot()) ComponentType(prototype);
+                    this->count++;
+                }
+            }
+
+            BaseStorage* make_empty_copy() {
+                return new ChunkedStorage<ComponentType, BlockSize>();
+            }
+
+        private:
+
+            //destroys the last component
+            void remove_end() {
+                count--;
+                at(count).~ComponentType();
+
+                //free the block after the last used one, but keep one spare block so
+                //an entity going back and forth at a block edge doesn't allocate every time
+                if(count % BlockSize == 0 && blocks.size() > count / BlockSize + 1) {
+                    ::operator delete(blocks.back(), std::align_val_t(alignment));
+                    blocks.pop_back();
+                }
+            }
+
+            inline ComponentType& at(uint64_t offset) {
+                return blocks[offset / BlockSize][offset % BlockSize];
+            }
+
+            //returns the memory right after the last component, allocating a new block if needed
+            inline ComponentType* next_slot() {
+                if(count == blocks.size() * BlockSize) {
+                    void* block = ::operator new(sizeof(ComponentType) * BlockSize, std::align_val_t(alignment));
+                    blocks.push_back((ComponentType*)block);
+                }
+                return &blocks[count / BlockSize][count % BlockSize];
+            }
+
+            std::vector<ComponentType*> blocks;
+            size_t count = 0;
+    };
+
+    /*
+        Chooses the storage a component type is stored in.
+        Specialize it to use another storage for a specific type.
+    */
+    template<typename ComponentType>
+    struct StorageType {
+        using type = ComponentStorage<ComponentType>;
+    };
+
+    template<typename ComponentType>
+    using StorageOf = typename StorageType<ComponentType>::type;
 }
\ No newline at end of file
@@ -1,7 +1,12 @@
 #pragma once
 #include "component_storage.h"
 #include "archetype.h"
+#include "command_buffer.h"
+#include "iterator.h"
+#include "query.h"
 #include "reference.h"
 #include "signal.h"
+#include "stats.h"
+#include "thread_pool.h"
 #include "types.h"
 #include "set.h"
\ No newline at end of file
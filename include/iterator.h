@@ -0,0 +1,365 @@
+#pragma once
+#include <utility>
+#include <algorithm>
+#include <tuple>
+#include <vector>
+#include "archetype.h"
+#include "types.h"
+
+namespace eset {
+
+    class Set;
+    class BaseQuery;
+
+    /*
+        Marks a component as optional inside a query. Entities without
+        the component are still iterated over, and instead of a reference
+        the iterator gives a pointer, which is null if it doesn't exist:
+
+        for(auto [entity, position, velocity] : set.iterator<Position, eset::Optional<Velocity>>()) {
+            if(velocity) { ... }
+        }
+    */
+    template<typename T>
+    struct Optional {};
+
+    /*
+        Reads a resource of the set inside a query. Every entity
+        gets a reference to the same resource, and the query gives
+        nothing if the set doesn't have it. See Set::set_resource.
+
+        for(auto [entity, position, time] : set.iterator<Position, eset::Resource<Time>>()) {
+            position.x += time.delta;
+        }
+    */
+    template<typename T>
+    struct Resource {};
+
+    /*
+        Describes how a type given to a query is matched
+        against the archetypes, and what the iterator gives.
+        The column of a tag is its shared instance, which
+        every entity gets.
+    */
+    template<typename T>
+    struct QueryTerm {
+        using Component = T;
+        using Result = T&;
+        static constexpr bool required = true;
+        static constexpr bool resource = false;
+
+        static inline Result get(Component* column, size_t index) {
+            if constexpr(is_tag<T>) {
+                return *column;
+            } else {
+                return column[index];
+            }
+        }
+    };
+
+    template<typename T>
+    struct QueryTerm<Optional<T>> {
+        using Component = T;
+        using Result = T*;
+        static constexpr bool required = false;
+        static constexpr bool resource = false;
+
+        static inline Result get(Component* column, size_t index) {
+            if constexpr(is_tag<T>) {
+                return column;
+            } else {
+                return column ? column + index : nullptr;
+            }
+        }
+    };
+
+    template<typename T>
+    struct QueryTerm<Resource<T>> {
+        using Component = T;
+        using Result = T&;
+        static constexpr bool required = false;
+        static constexpr bool resource = true;
+
+        static inline Result get(Component* column, size_t) {
+            return *column;
+        }
+    };
+
+    /*
+        Returns the signature of the components that
+        an archetype needs to match a query.
+    */
+    template<typename... T>
+    inline FastSignature required_signature() {
+        FastSignature sign;
+        ((QueryTerm<T>::required ? sign.add(Types::type_id<typename QueryTerm<T>::Component>()) : void()), ...);
+        return sign;
+    }
+
+    /*
+        A range of offsets inside an archetype. Used to
+        split up the work when iterating in parallel.
+    */
+    struct RowRange {
+        Archetype* archetype;
+        size_t begin;
+        size_t end;
+    };
+
+    /*
+        Iterates over every entity of a list of archetypes, giving
+        the entity and references to its components. The list isn't
+        copied, the iterator only points to it, so it stays a few
+        words in size no matter how many archetypes match.
+    */
+    template<typename... T>
+    class EntityIterator {
+        
+        public:
+
+            EntityIterator() = default;
+
+            EntityIterator(BaseQuery* query, const std::vector<Archetype*>* archetypes) {
+                this->query = query;
+                this->archetypes = archetypes;
+            }
+
+            /*
+                Returns an iterator that skips every entity that has any
+                of the given components. Whole archetypes are left out of
+                the list up front, so single entities are never checked:
+
+                for(auto [entity, position] : set.iterator<Position>().without<Dead>()) {
+                    ...
+                }
+            */
+            template<typename... Excluded>
+            EntityIterator without();
+
+            /*
+                Returns an iterator that only gives the entities whose component U
+                was changed (or added) after the given tick. Archetypes where
+                nothing happened after the tick are skipped entirely. Chained
+                filters all have to pass. See Set::advance_tick.
+            */
+            template<typename U>
+            EntityIterator changed(uint32_t since);
+
+            template<typename U>
+            EntityIterator added(uint32_t since);
+
+            inline EntityIterator begin() {
+
+                //a query that reads a resource the set doesn't have gives nothing
+                if(!(resource_exists<T>() && ...)) {
+                    return end();
+                }
+
+                EntityIterator it = *this;
+                it.archetype_index = 0;
+                if(it.enter_archetype()) {
+                    it.settle();
+                }
+                return it;
+            }
+
+            inline EntityIterator end() {
+                EntityIterator it;
+                it.archetype_index = -1;
+                it.entity_index = -1;
+                return it;
+            }
+
+            inline bool operator!=(EntityIterator& rhs) {
+                return archetype_index != rhs.archetype_index;
+            }
+
+            inline void operator++() {
+
+                entity_index++;
+
+                //everything that isn't a plain step to the next entity is handled at the stop index
+                if(entity_index == stop_index) {
+                    settle();
+                }
+            }
+
+            inline std::tuple<Entity, typename QueryTerm<T>::Result...> operator*() {
+                return get_tuple(std::make_index_sequence<sizeof...(T)>{});
+            }
+
+        private:
+            friend Set;
+            template<typename...> friend class Query;
+
+            inline Archetype* current_archetype() {
+                return (*archetypes)[archetype_index];
+            }
+
+            /*
+                Moves from the entity index to the next entity that can be given
+                out. Resolves the columns again where the current run of contiguous
+                components or the archetype ends, and skips the entities that don't
+                pass the tick filters. Then sets the stop index, where this needs
+                to be done again.
+            */
+            inline void settle() {
+                while(true) {
+                    if(entity_index == current_archetype()->count()) {
+                        archetype_index++;
+                        if(!enter_archetype()) {
+                            return;
+                        }
+                    } else if(entity_index == run_end) {
+                        set_storages(std::make_index_sequence<sizeof...(T)>{});
+                    }
+
+                    if(filters.empty()) {
+                        stop_index = run_end;
+                        return;
+                    } else if(passes_filters(entity_index)) {
+                        stop_index = entity_index + 1;
+                        return;
+                    }
+                    entity_index++;
+                }
+            }
+
+            /*
+                Returns true if the entity at the offset of the
+                current archetype passes every tick filter.
+            */
+            inline bool passes_filters(size_t offset) {
+                for(TickFilter& filter : filters) {
+                    if(filter.ticks[offset] <= filter.since) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            /*
+                Returns true if the archetype can't have any entity
+                that passes the tick filters.
+            */
+            inline bool filtered_out(Archetype* archetype) {
+                for(TickFilter& filter : filters) {
+                    BaseStorage* storage = archetype->compound[filter.id];
+                    if((filter.added ? storage->last_added_tick() : storage->last_changed_tick()) <= filter.since) {
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            template<typename U>
+            EntityIterator with_tick_filter(uint32_t since, bool added);
+
+            /*
+                Moves to the first archetype from the archetype index
+                that isn't empty, or to the end if there is none.
+                Returns false when the end is reached.
+            */
+            inline bool enter_archetype() {
+                while(archetype_index < archetypes->size() && ((*archetypes)[archetype_index]->count() == 0 || filtered_out((*archetypes)[archetype_index]))) {
+                    archetype_index++;
+                }
+
+                if(archetype_index == archetypes->size()) {
+                    archetype_index = -1;
+                    entity_index = -1;
+                    return false;
+                }
+
+                entity_index = 0;
+                set_storages(std::make_index_sequence<sizeof...(T)>{});
+                for(TickFilter& filter : filters) {
+                    BaseStorage* storage = current_archetype()->compound[filter.id];
+                    filter.ticks = filter.added ? storage->added_ticks() : storage->changed_ticks();
+                }
+                return true;
+            }
+
+            template<size_t... index>
+            inline std::tuple<Entity, typename QueryTerm<T>::Result...> get_tuple(std::integer_sequence<size_t, index...>) {
+                size_t run_index = entity_index - run_start;
+                return {entities[run_index], QueryTerm<T>::get(std::get<index>(columns), run_index)...};
+            }
+
+            /*
+                Resolves the typed pointers of every column, starting at the
+                current entity index. They stay valid until run_end, which is
+                where the first of the columns stops being contiguous.
+                Optional components that don't exist get a null pointer.
+            */
+            template<size_t... index>
+            inline void set_storages(std::integer_sequence<size_t, index...>) {
+                Archetype* archetype = current_archetype();
+                run_start = entity_index;
+                run_end = archetype->count();
+                entities = archetype->offset_to_entity.data() + run_start;
+                ((std::get<index>(columns) = resolve_column<T>(archetype)), ...);
+            }
+
+            /*
+                Returns the resource of the set, or nullptr if it doesn't have it.
+            */
+            template<typename U>
+            U* find_resource();
+
+            template<typename Term>
+            inline bool resource_exists() {
+                if constexpr(QueryTerm<Term>::resource) {
+                    return find_resource<typename QueryTerm<Term>::Component>() != nullptr;
+                } else {
+                    return true;
+                }
+            }
+
+            template<typename Term>
+            inline typename QueryTerm<Term>::Component* resolve_column(Archetype* archetype) {
+                if constexpr(QueryTerm<Term>::resource) {
+                    return find_resource<typename QueryTerm<Term>::Component>();
+                } else {
+                    size_t id = Types::type_id<typename QueryTerm<Term>::Component>();
+                    if(!QueryTerm<Term>::required && !archetype->fast_signature.contains(id)) {
+                        return nullptr;
+                    }
+
+                    //tags don't break runs, since every entity shares their instance
+                    if constexpr(is_tag<typename QueryTerm<Term>::Component>) {
+                        return &tag_instance<typename QueryTerm<Term>::Component>();
+                    } else {
+                        BaseStorage* storage = archetype->compound[id];
+                        run_end = std::min(run_end, run_start + storage->contiguous_count(run_start));
+                        return (typename QueryTerm<Term>::Component*)storage->get_component_pointer(run_start);
+                    }
+                }
+            }
+
+            BaseQuery* query = nullptr;
+            const std::vector<Archetype*>* archetypes = nullptr;
+            size_t archetype_index = -1;
+            size_t entity_index = -1;
+            size_t stop_index = 0;
+            size_t run_start = 0;
+            size_t run_end = 0;
+            Entity* entities = nullptr;
+            std::tuple<typename QueryTerm<T>::Component*...> columns;
+
+            /*
+                A tick filter. Only entities whose component with the
+                id has a tick after the since tick pass. The ticks are
+                the ones of the current archetype.
+            */
+            struct TickFilter {
+                size_t id;
+                uint32_t since;
+                bool added;
+                const uint32_t* ticks;
+            };
+
+            //the tick filters, which every entity has to pass. Usually none or one
+            std::vector<TickFilter> filters;
+    };
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include <vector>
+#include "archetype.h"
+#include "iterator.h"
+#include "types.h"
+
+namespace eset {
+
+    class Set;
+
+    /*
+        The type independent part of a query. It registers
+        itself with a set, and the set tells it about every
+        archetype that gets created, so the list of matching
+        archetypes never has to be searched for again.
+    */
+    class BaseQuery {
+        public:
+
+            /*
+                Creates a query over the archetypes that contain every
+                component of the signature and none of the excluded ones.
+            */
+            BaseQuery(Set& set, FastSignature signature, FastSignature excluded = FastSignature());
+
+            /*
+                Unregisters the query from its set,
+                if the set still exists.
+            */
+            virtual ~BaseQuery();
+
+            //a query can't be copied, since the set points to it
+            BaseQuery(const BaseQuery&) = delete;
+            BaseQuery& operator=(const BaseQuery&) = delete;
+
+            /*
+                Returns the set this query belongs to. Can be
+                null if the set no longer exist.
+            */
+            Set* set();
+
+            /*
+                Returns the amount of archetypes that match
+                this query, including the empty ones.
+            */
+            size_t archetype_count();
+
+        protected:
+            friend Set;
+            template<typename...> friend class EntityIterator;
+
+            /*
+                Adds the archetype to the matching archetypes, if it has
+                every component of the query and none of the excluded ones.
+            */
+            void add_archetype(Archetype* archetype);
+
+            Set* m_set;
+            FastSignature m_signature;
+            FastSignature m_excluded;
+            std::vector<Archetype*> m_archetypes;
+    };
+
+    /*
+        A persistent query over every entity that has the given
+        components. The components can be wrapped in Optional.
+        Keep it around, for example inside a system,
+        instead of calling Set::iterator every frame:
+
+        eset::Query<Position, Velocity> moving(set);
+        for(auto [entity, position, velocity] : moving.iterator()) {
+            ...
+        }
+    */
+    template<typename... Ts>
+    class Query : public BaseQuery {
+        public:
+
+            Query(Set& set) : BaseQuery(set, required_signature<Ts...>()) {}
+
+            /*
+                Returns an iterator over every entity
+                that matches this query.
+            */
+            EntityIterator<Ts...> iterator() {
+                return EntityIterator<Ts...>(this, &m_archetypes);
+            }
+
+            /*
+                Calls the function once for every contiguous chunk
+                of entities that matches this query. See Set::each_chunk.
+                This doesn't support Optional components.
+            */
+            template<typename Function>
+            void each_chunk(Function function) {
+                for(Archetype* archetype : m_archetypes) {
+                    archetype->for_each_run<Ts...>(0, archetype->count(), function);
+                }
+            }
+    };
+}
@@ -4,6 +4,9 @@
 namespace eset {
 
     class Set;
+    class BaseStorage;
+
+    struct ReferenceBlock;
 
     /* Underlying reference data generated by the entity set */
     struct ReferenceData {
@@ -14,6 +17,21 @@ namespace eset {
         size_t m_offset;
         Entity m_entity;
         Set* m_set;
+
+        //the slab block this data lives in
+        ReferenceBlock* m_block;
+    };
+
+    /*
+        A slab of reference datas. The set hands them out from
+        its free list, so creating a reference doesn't allocate.
+        A block outlives its set while any of its datas is still
+        referenced, and is freed by the last reference instead.
+    */
+    struct ReferenceBlock {
+        static constexpr size_t size = 256;
+        ReferenceData datas[size];
+        size_t used = 0;
     };
 
     class BaseReference {
@@ -44,7 +62,7 @@ namespace eset {
             bool valid();
 
         protected:
-            void let_set_delete_reference_data();
+            void release_reference_data();
             ReferenceData* m_reference_data;
     };
 
@@ -136,22 +154,14 @@ namespace eset {
             /*
                 Lowers the reference count by 1 in the underlying
                 data. If the reference count becomes 0 after this,
-                and the entity set is null, it will free the 
-                underlying data's memory. If the entity set
-                does exist, it will handle the deletion.
+                the data goes back to the entity set, or if the set
+                no longer exists, its block is freed once unused.
             */
             ~Ref() {
                 if(m_reference_data) {
                     m_reference_data->m_reference_count--;
-                    if(!m_reference_data->m_set) {
-                        if(m_reference_data->m_reference_count == 0) {
-                            delete m_reference_data;
-                        }
-                    } else {
-                        if(m_reference_data->m_reference_count == 0) {
-                            //let the entity set delete it
-                            let_set_delete_reference_data();
-                        }
+                    if(m_reference_data->m_reference_count == 0) {
+                        release_reference_data();
                     }
                 }
             }
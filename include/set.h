@@ -1,104 +1,41 @@
 #pragma once
 #include <vector>
+#include <deque>
 #include <string>
 #include <unordered_map>
-#include <unordered_set>
 #include <array>
 #include <chrono>
+#include <memory>
 #include <utility>
+#include <algorithm>
+#include <tuple>
+#include <span>
 #include "archetype.h"
+#include "command_buffer.h"
+#include "iterator.h"
+#include "query.h"
 #include "reference.h"
 #include "signal.h"
+#include "stats.h"
+#include "thread_pool.h"
 #include "types.h"
 
 namespace eset {
 
     class Set;
 
-    template<typename... T>
-    class EntityIterator {
-        
-        public:
-            inline EntityIterator begin() {
-
-                EntityIterator it;
-                it.archetype_index = 0;
-                it.entity_index = 0;
-                it.archetype_count = archetype_count;
-
-                //copy archetype pointers
-                for(size_t i = 0; i < archetype_count; i++) {
-                    it.archetypes[i] = archetypes[i];
-                }
-
-                if(archetype_count > 0) {
-                    it.current_archetype = archetypes[0];
-                    it.set_storages(std::make_index_sequence<sizeof...(T)>{});
-                } else {
-                    it.archetype_index = -1;
-                    it.entity_index = -1;
-                }
-
-                return it;
-            }
-
-            inline EntityIterator end() {
-                EntityIterator it;
-                it.archetype_index = -1;
-                it.entity_index = -1;
-                return it;
-            }
-
-            inline bool operator!=(EntityIterator& rhs) {
-                return archetype_index != rhs.archetype_index;
-            }
-
-            inline void operator++() {
-
-                size_t max_entities = current_archetype->count();
-                entity_index++;
-
-                if(entity_index == max_entities) {
-                    entity_index = 0;
-                    archetype_index++;
-
-                    if(archetype_index == archetype_count) {
-                        archetype_index = -1;
-                        entity_index = -1;
-                    } else {
-                        current_archetype = archetypes[archetype_index];
-                        set_storages(std::make_index_sequence<sizeof...(T)>{});
-                    }
-                }
-            }
-
-            inline std::tuple<Entity, T&...> operator*() {
-                return get_tuple(std::make_index_sequence<sizeof...(T)>{});
-            }
-
-        private:
-            friend Set;
-
-            template<size_t... index>
-            inline std::tuple<Entity, T&...> get_tuple(std::integer_sequence<size_t, index...>) {
-                return {current_archetype->get_entity(entity_index), (*(T*)storages[index]->get_component_pointer(entity_index))...};
-            }
-
-            template<size_t... index>
-            inline void set_storages(std::integer_sequence<size_t, index...>) {
-                ((storages[index] = current_archetype->compound[Types::type_id<T>()]), ...);
-            }
-
-            static size_t counter;
-            size_t archetype_index;
-            size_t entity_index;
-            size_t archetype_count = 0;
-            Archetype* current_archetype = nullptr;
-            BaseStorage* storages[sizeof...(T)];
-            Archetype* archetypes[128];
+    /*
+        Where an entity is stored inside a set.
+        Dead entities have an archetype index of -1.
+        The generation is the one of the entity that
+        currently uses, or will next use, this index.
+    */
+    struct EntitySlot {
+        size_t archetype_index = -1;
+        size_t offset = 0;
+        uint32_t generation = 0;
     };
 
-
     //An ECS collection with all the entites stored inside compounds, that are stored in specific archetypes(archetypes).
     class Set {
         public:
@@ -125,115 +62,354 @@ namespace eset {
             Entity create();
 
             /*
-                Tries to inserts a component into an entity.
+                Creates count entities that all get a copy of the given
+                prototype components. The entities are put directly into
+                the archetype of those components, with every column
+                reserved once. Returns the new entities.
+            */
+            template<typename... Ts>
+            std::vector<Entity> create_many(size_t count, const Ts&... prototypes) {
+
+                //copy the entities out before the observers can change the archetype
+                Archetype& archetype = create_rows<Ts...>(count, prototypes...);
+                std::vector<Entity> created(archetype.offset_to_entity.end() - count, archetype.offset_to_entity.end());
+                ((emit_on_insert(Types::type_id<Ts>(), created)), ...);
+                return created;
+            }
+
+            /*
+                Same as create_many, but returns a view of the new entities
+                inside a buffer of the set instead of a new vector. The buffer
+                is filled after the observers have run, so the view is valid
+                until the next call to create_many_span.
+            */
+            template<typename... Ts>
+            std::span<const Entity> create_many_span(size_t count, const Ts&... prototypes) {
+
+                Archetype& archetype = create_rows<Ts...>(count, prototypes...);
+                if((observed.contains(Types::type_id<Ts>()) || ...)) {
+                    std::vector<Entity> created(archetype.offset_to_entity.end() - count, archetype.offset_to_entity.end());
+                    ((emit_on_insert(Types::type_id<Ts>(), created)), ...);
+                    created_entities = std::move(created);
+                } else {
+                    created_entities.assign(archetype.offset_to_entity.end() - count, archetype.offset_to_entity.end());
+                }
+                return created_entities;
+            }
+
+            /*
+                Tries to inserts one or more components into an entity.
                 Returns true on success, and false on failure.
                 If the entity already has a certain component,
                 this function will overwrite it, and then return
-                true.
+                true. When several components are missing, the entity
+                is moved straight to the final archetype, without
+                going through (or creating) the ones in between.
             */
-            template<typename T>
-            bool insert(Entity entity, T component) {
+            template<typename... Ts>
+            bool insert(Entity entity, Ts... components) {
+
+                static_assert(sizeof...(Ts) > 0, "insert needs at least one component");
 
                 //check if the entity exists
-                auto archetype_index_it = entities.find(entity);
-                if(archetype_index_it != entities.end()) {
+                EntitySlot* slot = find_slot(entity);
+                if(!slot) {
 
-                    //it exists
-                    size_t archetype_index = archetype_index_it->second;
-                    Archetype& current_archetype = archetypes[archetype_index];
+                    //else the entity didn't exist. Return false.
+                    return false;
+                }
 
-                    //check if the current archetype already has this component
-                    if(current_archetype.has_component<T>()) {
-                        
-                        //then we replace it with the new one that was given
-                        size_t offset = current_archetype.entity_to_offset[entity];
-                        BaseStorage* storage = current_archetype.compound[Types::type_id<T>()];
-                        storage->set_component(offset, &component);
+                //check which components the current archetype already has
+                size_t archetype_index = slot->archetype_index;
+                std::array<bool, sizeof...(Ts)> had_component = {archetypes[archetype_index].has_component<Ts>()...};
 
-                    } else {
+                //move the entity with all its current components
+                size_t new_archetype_index = archetype_with<Ts...>(archetype_index);
+                if(new_archetype_index != archetype_index) {
+                    move_entity(entity, new_archetype_index);
+                }
 
-                        //it doesn't exist, we need to check if there is a archetype that fits the spec of the new entity
-                        ArchetypeSignature signature = current_archetype.get_archetype_signature();
-                        signature.add(Types::type_id<T>(), sizeof(T));
-                        size_t archetype_try = find_archetype(signature);
+                //then insert the new components and replace the old ones with the ones that were given
+                Archetype& archetype = archetypes[slot->archetype_index];
+                size_t i = 0;
+                ((insert_component(archetype, slot->offset, had_component[i++], components)), ...);
+                i = 0;
+                ((had_component[i++] ? void() : emit_on_insert(Types::type_id<Ts>(), entity)), ...);
+                return true;
+            }
+
+            /*
+                Inserts a copy of the given components into every entity in the
+                span that exists, overwriting the components they already have.
+                The entities are moved per archetype they come from, with runs
+                of consecutive rows copied at once, so moving many entities
+                costs about as much as copying their components.
+                Returns the amount of entities that existed.
+            */
+            template<typename... Ts>
+            size_t insert_many(std::span<const Entity> entities, const Ts&... prototypes) {
+
+                static_assert(sizeof...(Ts) > 0, "insert_many needs at least one component");
+
+                //group the rows by the archetype they are in. Neighbouring
+                //entities are usually in the same one, so remember the last
+                std::unordered_map<size_t, std::vector<size_t>> rows;
+                size_t last_index = -1;
+                std::vector<size_t>* last_rows = nullptr;
+                for(Entity entity : entities) {
+                    EntitySlot* slot = find_slot(entity);
+                    if(slot) {
+                        if(slot->archetype_index != last_index) {
+                            last_index = slot->archetype_index;
+                            last_rows = &rows[last_index];
+                        }
+                        last_rows->push_back(slot->offset);
+                    }
+                }
 
-                        //couldn't find a archetype, we need to create one and swap with the new one
-                        if(archetype_try == -1) {
+                //the observers are told at the end, since they could change the archetypes
+                std::array<std::vector<Entity>, sizeof...(Ts)> gained;
 
-                            size_t new_archetype_index = archetypes.size();
+                size_t inserted = 0;
+                for(auto& [archetype_index, offsets] : rows) {
 
-                            //get the signatures
-                            std::vector<BaseStorage*> storage_pointers;
-                            for(size_t i = 0; i < current_archetype.compound_indices.size(); i++) {
-                                //std::cout << i << "\n";
-                                BaseStorage* copy = current_archetype.compound[current_archetype.compound_indices[i]]->make_empty_copy();
-                                storage_pointers.push_back(copy);
+                    //entities straight from an iteration or create_many are already in order
+                    if(!std::is_sorted(offsets.begin(), offsets.end())) {
+                        std::sort(offsets.begin(), offsets.end());
+                    }
+                    offsets.erase(std::unique(offsets.begin(), offsets.end()), offsets.end());
+                    inserted += offsets.size();
+
+                    //overwrite the components the entities already have
+                    Archetype& source = archetypes[archetype_index];
+                    std::array<bool, sizeof...(Ts)> had_component = {source.has_component<Ts>()...};
+                    size_t i = 0;
+                    ((had_component[i++] ? overwrite_rows(source, offsets, prototypes) : void()), ...);
+
+                    //then move them all and add the missing components at the end
+                    size_t new_archetype_index = archetype_with<Ts...>(archetype_index);
+                    if(new_archetype_index != archetype_index) {
+                        move_rows(archetype_index, offsets, new_archetype_index);
+                        Archetype& archetype = archetypes[new_archetype_index];
+                        i = 0;
+                        ((had_component[i++] ? void() : push_back_copies(archetype, offsets.size(), prototypes)), ...);
+
+                        //remember the moved entities for every observed component they didn't have
+                        const Entity* moved = archetype.offset_to_entity.data() + archetype.count() - offsets.size();
+                        auto collect = [&](size_t type, size_t id) {
+                            if(!had_component[type] && observed.contains(id)) {
+                                gained[type].insert(gained[type].end(), moved, moved + offsets.size());
                             }
-                            BaseStorage* new_storage = new ComponentStorage<T>();
-                            storage_pointers.push_back(new_storage);
-                            archetypes.emplace_back(storage_pointers);
+                        };
+                        i = 0;
+                        ((collect(i++, Types::type_id<Ts>())), ...);
+                    }
+                }
 
-                            //swap
-                            Archetype& new_archetype = archetypes[new_archetype_index];
-                            new_archetype.insert_entity(entity);
+                size_t type = 0;
+                ((emit_on_insert(Types::type_id<Ts>(), gained[type++])), ...);
+                return inserted;
+            }
 
-                            size_t old_offset = archetypes[archetype_index].entity_to_offset[entity];
-                            size_t new_offset = new_archetype.entity_to_offset[entity];
+            /*
+                Tries to remove a component from an entity.
+                The entity is moved straight to the archetype without
+                the component, so only the removed component is destroyed,
+                and references to the other components stay valid.
+                Returns true on success, and false if the entity doesn't
+                exist or doesn't have the component.
+            */
+            template<typename T>
+            bool remove_component(Entity entity) {
 
-                            for(size_t id : archetypes[archetype_index].compound_indices) {
-                                BaseStorage* storage = archetypes[archetype_index].compound[id];
-                                void* data = storage->get_component_pointer(old_offset);
-                                new_archetype.compound[id]->push_back(data);
+                //check if the entity exists
+                EntitySlot* slot = find_slot(entity);
+                if(!slot) {
+                    return false;
+                }
+
+                if(!archetypes[slot->archetype_index].has_component<T>()) {
+                    return false;
+                }
 
-                                //swap references
-                                swap_reference_data(storage, old_offset, new_archetype.compound[id], new_offset);
+                //the component's end of lifetime. Its references are made invalid when
+                //the entity leaves the old archetype, the rest are moved with it.
+                size_t id = Types::type_id<T>();
+                emit_on_remove(id, entity);
+
+                //the observers could have changed the entity, so look it up again
+                slot = find_slot(entity);
+                if(!slot || !archetypes[slot->archetype_index].has_component<T>()) {
+                    return false;
+                }
+                size_t archetype_index = slot->archetype_index;
+                Archetype& current_archetype = archetypes[archetype_index];
+
+                //check if we have already made this transition before
+                size_t new_archetype_index;
+                auto edge = current_archetype.remove_edges.find(id);
+                if(edge != current_archetype.remove_edges.end()) {
+                    new_archetype_index = edge->second;
+                } else {
+
+                    //we haven't, look for an archetype with every component and tag except this one
+                    FastSignature signature;
+                    std::vector<size_t> tag_ids;
+                    for(size_t compound_id : current_archetype.compound_indices) {
+                        if(compound_id != id) {
+                            signature.add(compound_id);
+                        }
+                    }
+                    for(size_t tag_id : current_archetype.tag_indices) {
+                        if(tag_id != id) {
+                            signature.add(tag_id);
+                            tag_ids.push_back(tag_id);
+                        }
+                    }
+                    new_archetype_index = find_archetype(signature);
+
+                    //couldn't find a archetype, we need to create one
+                    if(new_archetype_index == -1) {
+                        std::vector<BaseStorage*> storage_pointers;
+                        for(size_t compound_id : current_archetype.compound_indices) {
+                            if(compound_id != id) {
+                                storage_pointers.push_back(current_archetype.compound[compound_id]->make_empty_copy());
                             }
+                        }
+                        new_archetype_index = create_archetype(storage_pointers, tag_ids);
+                    }
 
-                            //remove from old archetype
-                            archetypes[archetype_index].remove_entity(entity, nullptr);
+                    //remember the transition, so the next removal is a single lookup
+                    archetypes[archetype_index].remove_edges[id] = new_archetype_index;
+                    archetypes[new_archetype_index].add_edges[id] = archetype_index;
+                }
 
-                            //insert the new component
-                            size_t id = Types::type_id<T>();
-                            new_archetype.compound[id]->push_back(&component);
-                            
-                            //change archetype index since we moved it
-                            archetype_index_it->second = new_archetype_index;
+                move_entity(entity, new_archetype_index);
+                return true;
+            }
 
-                        } else {
+            /*
+                Marks a component of an entity as changed at the current
+                tick, so it shows up in changed filters. Inserting already
+                does this, but writes through pointers, references and
+                iterators need to be marked with this function.
+                Returns false if the entity doesn't have the component.
+            */
+            template<typename T>
+            bool mark_changed(Entity entity) {
+                static_assert(!is_tag<T>, "tags have no ticks");
+                EntitySlot* slot = find_slot(entity);
+                if(slot && archetypes[slot->archetype_index].has_component<T>()) {
+                    archetypes[slot->archetype_index].compound[Types::type_id<T>()]->set_changed_tick(slot->offset, change_tick);
+                    return true;
+                } else {
+                    return false;
+                }
+            }
 
-                            //found one!! swap with this!
-                            Archetype& new_archetype = archetypes[archetype_try];
-                            new_archetype.insert_entity(entity);
+            /*
+                Returns the current tick. Inserted and changed
+                components are stamped with it.
+            */
+            uint32_t current_tick();
 
-                            size_t old_offset = archetypes[archetype_index].entity_to_offset[entity];
-                            size_t new_offset = new_archetype.entity_to_offset[entity];
-                            for(size_t id : archetypes[archetype_index].compound_indices) {
-                                BaseStorage* storage = archetypes[archetype_index].compound[id];
-                                void* data = storage->get_component_pointer(old_offset);
-                                new_archetype.compound[id]->push_back(data);
+            /*
+                Ends the current tick and returns it. A system can keep the
+                returned tick and give it to the changed and added filters
+                next time it runs, to only see what happened after it ran:
 
-                                //swap references
-                                swap_reference_data(storage, old_offset, new_archetype.compound[id], new_offset);
-                            }
+                for(auto [entity, position] : set.iterator<Position>().changed<Position>(last_run)) {
+                    ...
+                }
+                last_run = set.advance_tick();
+            */
+            uint32_t advance_tick();
 
-                            //remove from old archetype
-                            current_archetype.remove_entity(entity, nullptr);
+            /*
+                Returns a snapshot of the archetypes, the memory they use
+                and the counters of the set. Only looks at sizes, never at
+                the components, so it's cheap enough to call every frame.
+            */
+            SetStats stats();
 
-                            //insert the new component
-                            size_t id = Types::type_id<T>();
-                            new_archetype.compound[id]->push_back(&component);
-                            
-                            //change archetype index since we moved it
-                            archetype_index_it->second = archetype_try;
-                        }
-                    }
-                    return true;
+            /*
+                Sets the migration, swap-remove and archetype
+                miss counters back to zero.
+            */
+            void reset_counters();
+
+            /*
+                Writes every entity of the set, with its components and their
+                ticks, to a file. Trivially copyable components are written as
+                they are in memory, others with the serializer of their type,
+                see Types::set_serializer. References, resources and signal
+                connections aren't saved. Returns false if a component type
+                has no way to be written or shares its name with another type,
+                or the file couldn't be written.
+            */
+            bool save(const std::string& path);
 
+            /*
+                Reads a file written by save into a set that never had any
+                entities, keeping the entities as they were, generations
+                included. The file is mapped and raw columns are copied out
+                of it in one go, so loading runs at about the speed of the disk.
+                Every component type in the file must be known to the program,
+                by having been used or with Types::type_id, and must have the
+                same size. Returns false, leaving the set untouched, if the
+                file can't be read, is of another version or machine byte order,
+                or doesn't match the component types of the program.
+                Saved files are only meant to be loaded by the same build.
+            */
+            bool load(const std::string& path);
+
+            /*
+                Stores a single value of a type in the set, outside of every
+                archetype, or replaces the one that is already stored. Useful
+                for state that isn't about a single entity, like the time or the
+                input. The resource stays at the same address until it's removed.
+                Returns the stored resource. Resources take a type id, like components.
+            */
+            template<typename T>
+            T& set_resource(T value) {
+                size_t id = Types::type_id<T>();
+                if(id >= resources.size()) {
+                    resources.resize(id + 1);
+                }
+
+                ResourceSlot& slot = resources[id];
+                if(slot.value) {
+                    *(T*)slot.value = std::move(value);
                 } else {
+                    slot.value = new T(std::move(value));
+                    slot.destroy = [](void* value) { delete (T*)value; };
+                }
+                return *(T*)slot.value;
+            }
 
-                    //else the entity didn't exist. Return false.
+            /*
+                Returns the resource of a type, or nullptr if the
+                set doesn't have one. A single indexed load.
+            */
+            template<typename T>
+            T* resource() {
+                size_t id = Types::type_id<T>();
+                return id < resources.size() ? (T*)resources[id].value : nullptr;
+            }
+
+            /*
+                Destroys the resource of a type. Returns
+                false if the set didn't have one.
+            */
+            template<typename T>
+            bool remove_resource() {
+                size_t id = Types::type_id<T>();
+                if(id >= resources.size() || !resources[id].value) {
                     return false;
                 }
+                resources[id].destroy(resources[id].value);
+                resources[id] = ResourceSlot();
+                return true;
             }
 
             /*
@@ -243,16 +419,17 @@ namespace eset {
             */
             template<typename T>
             Ref<T> get(Entity entity) {
-                
+                static_assert(!is_tag<T>, "tags can't be referenced, use get_raw");
+
                 //check if it exists
-                auto archetype_index_it = entities.find(entity);
-                if(archetype_index_it != entities.end()) {
+                EntitySlot* slot = find_slot(entity);
+                if(slot) {
 
                     //if it does, get the raw pointer to the component
-                    size_t archetype_index = archetype_index_it->second;
-                    if(archetypes[archetype_index].has_component<T>()) {
-                        BaseStorage* storage = archetypes[archetype_index].compound[Types::type_id<T>()];
-                        size_t offset = archetypes[archetype_index].entity_to_offset[entity];
+                    Archetype& archetype = archetypes[slot->archetype_index];
+                    if(archetype.has_component<T>()) {
+                        BaseStorage* storage = archetype.compound[Types::type_id<T>()];
+                        size_t offset = slot->offset;
 
                         //then get the reference data and return it wrapped in a reference
                         ReferenceData* underlying_reference_data = reference_data(storage, offset);
@@ -275,12 +452,11 @@ namespace eset {
             T* get_raw(Entity entity) {
 
                 //check if it exists
-                auto archetype_index_it = entities.find(entity);
-                if(archetype_index_it != entities.end()) {
+                EntitySlot* slot = find_slot(entity);
+                if(slot) {
 
                     //if it does, return the component from the archetype
-                    size_t archetype_index = archetype_index_it->second;
-                    return archetypes[archetype_index].get_component<T>(entity);
+                    return archetypes[slot->archetype_index].get_component<T>(slot->offset);
                 } else {
 
                     //else return nullptr, since the entity doesn't exist
@@ -301,13 +477,12 @@ namespace eset {
             template<typename... Ts>
             std::tuple<Ts*...> get_components(Entity entity) {
                 //check if it exists
-                auto archetype_index_it = entities.find(entity);
-                if(archetype_index_it != entities.end()) {
+                EntitySlot* slot = find_slot(entity);
+                if(slot) {
 
                     //if it does, return the component from the archetype
-                    size_t archetype_index = archetype_index_it->second;
-                    Archetype* archetype = &archetypes[archetype_index];
-                    return {(archetype->get_component<Ts>(entity))...};
+                    Archetype* archetype = &archetypes[slot->archetype_index];
+                    return {(archetype->get_component<Ts>(slot->offset))...};
                 } else {
 
                     //else return nullptr, since the entity doesn't exist
@@ -319,59 +494,94 @@ namespace eset {
                 Returns an iterator based on the 
                 type arguments given. This then iterators over
                 every entity that has these components.
+                Components wrapped in Optional don't have to exist.
+                The matching archetypes are remembered, so this
+                doesn't search through the archetypes after the
+                first call with the same components.
             */
             template<typename... T>
             EntityIterator<T...> iterator() {
+                BaseQuery& query = cached_query(required_signature<T...>());
+                return EntityIterator<T...>(&query, &query.m_archetypes);
+            }
+
+            /*
+                Calls the function once for every contiguous chunk of
+                entities that have the given components, with a span of
+                the entities and a span for every component:
+                function(std::span<const Entity>, std::span<Ts>...)
+                A chunk is a whole archetype, or a block of one when a
+                component uses a chunked storage. Entities shouldn't be
+                created, removed or change components inside the function.
+            */
+            template<typename... Ts, typename Function>
+            void each_chunk(Function function) {
 
                 FastSignature sign;
-                ((sign.add(Types::type_id<T>())), ...);
-
-                //construct iterator
-                EntityIterator<T...> iter;
-                iter.archetype_index = 0;
-                iter.entity_index = 0;
-                iter.archetype_count = 0;
-
-                //find archetypes
-                for(size_t i = 0; i < archetypes.size(); i++) {
-                    if(archetypes[i].count() > 0) {
-                        if(archetypes[i].get_fast_signature().contains(sign)) {
-                            iter.archetypes[iter.archetype_count] = &archetypes[i];
-                            iter.archetype_count++;
-                        }
-                    }
+                ((sign.add(Types::type_id<Ts>())), ...);
+
+                for(Archetype* archetype : cached_query(sign).m_archetypes) {
+                    archetype->for_each_run<Ts...>(0, archetype->count(), function);
                 }
+            }
+
+            /*
+                Same as each_chunk, but the chunks are spread over the
+                set's thread pool. Big archetypes are split up in row ranges,
+                so a single archetype still uses every worker. The function
+                is called from several threads at once.
+            */
+            template<typename... Ts, typename Function>
+            void par_each_chunk(Function function) {
 
-                return iter;
+                FastSignature sign;
+                ((sign.add(Types::type_id<Ts>())), ...);
+
+                std::vector<RowRange> ranges = split_rows(cached_query(sign).m_archetypes);
+                thread_pool().run(ranges.size(), [&](size_t i) {
+                    ranges[i].archetype->for_each_run<Ts...>(ranges[i].begin, ranges[i].end, function);
+                });
+            }
+
+            /*
+                Calls function(Entity, Ts&...) for every entity that has
+                the given components, spread over the set's thread pool.
+                The function is called from several threads at once.
+            */
+            template<typename... Ts, typename Function>
+            void par_each(Function function) {
+                par_each_chunk<Ts...>([&function](std::span<const Entity> entities, std::span<Ts>... components) {
+                    for(size_t i = 0; i < entities.size(); i++) {
+                        function(entities[i], components[i]...);
+                    }
+                });
             }
 
+            /*
+                Sets how many threads the parallel iteration uses,
+                including the calling thread. 0 means one per
+                hardware thread, which is the default.
+            */
+            void set_worker_count(size_t worker_count);
+
             /*
                 Tries to find a archetype with a given signature.
                 Returns the index if it exists, otherwise it returns
                 -1. Since this is a size_t, it means that it will return
                 the largest value. (infinity..?)
             */
-            size_t find_archetype(ArchetypeSignature& signature);
+            size_t find_archetype(FastSignature& signature);
 
             /*
                 Connects a function to a signal
                 that fires when a specific 
                 components gets destroyed! 
+                Returns the connection that
+                disconnects it again.
             */
             template<typename T>
-            void connect_on_remove(std::function<void(Entity)> function) {
-                on_remove_signals[Types::type_id<T>()].connect(function);
-            }
-
-            /*
-                Disconnects a function to 
-                a signal that fires when 
-                a specific function gets
-                removed.
-            */
-            template<typename T>
-            void disconnect_on_remove(std::function<void(Entity)> function) {
-                on_remove_signals[Types::type_id<T>()].disconnect(function);
+            Connection connect_on_remove(std::function<void(Entity)> function) {
+                return observers_of(Types::type_id<T>()).on_remove.connect(function);
             }
 
             /*
@@ -379,53 +589,517 @@ namespace eset {
                 requires an instance to a signal
                 that fires when a specific 
                 components gets destroyed!
+                Disconnect it at the latest when
+                the lifetime of the instance runs
+                out. Otherwise the signal might
+                throw a segmentation fault when emiting.
             */
             template<typename T, typename Function, typename InstanceType>
-            void connect_on_remove(Function function, InstanceType instance) {
-                on_remove_signals[Types::type_id<T>()].connect(function, instance);
+            Connection connect_on_remove(Function function, InstanceType& instance) {
+                return observers_of(Types::type_id<T>()).on_remove.connect(function, instance);
             }
-            
+
             /*
-                Disconnects a function that
-                requires an instance to a signal
-                that fires when a specific 
-                components gets destroyed!
-                This should be done at most
-                when the lifetime of the instance
-                runs out. Otherwise the signal might
-                throw a segmentation fault when emiting.
+                Disconnects a function from
+                the signal that fires when a
+                specific component gets removed.
+                Returns false if it wasn't connected.
+            */
+            template<typename T>
+            bool disconnect_on_remove(Connection connection) {
+                size_t id = Types::type_id<T>();
+                return id < observers.size() && observers[id].on_remove.disconnect(connection);
+            }
+
+            /*
+                Connects a function to a signal that fires when an
+                entity gets a component it didn't have before, after
+                the component has been stored. Overwriting a component
+                doesn't fire it.
             */
+            template<typename T>
+            Connection connect_on_insert(std::function<void(Entity)> function) {
+                return observers_of(Types::type_id<T>()).on_insert.connect(function);
+            }
+
             template<typename T, typename Function, typename InstanceType>
-            void disconnect_on_remove(Function function, InstanceType instance) {
-                on_remove_signals[Types::type_id<T>()].disconnect(function, instance);
+            Connection connect_on_insert(Function function, InstanceType& instance) {
+                return observers_of(Types::type_id<T>()).on_insert.connect(function, instance);
+            }
+
+            template<typename T>
+            bool disconnect_on_insert(Connection connection) {
+                size_t id = Types::type_id<T>();
+                return id < observers.size() && observers[id].on_insert.disconnect(connection);
+            }
+
+            /*
+                Connects a function that is called with every entity that got
+                or lost a component since the last flush, once per flush instead
+                of once per entity. Flushing happens in flush_observers and at the
+                end of CommandBuffer::flush. Removed entities may no longer exist
+                when they are delivered, and an entity can be in both batches.
+            */
+            template<typename T>
+            Connection connect_on_insert_batch(std::function<void(std::span<const Entity>)> function) {
+                return observers_of(Types::type_id<T>()).on_insert_batch.connect(function);
             }
-            
+
+            template<typename T>
+            bool disconnect_on_insert_batch(Connection connection) {
+                size_t id = Types::type_id<T>();
+                return id < observers.size() && observers[id].on_insert_batch.disconnect(connection);
+            }
+
+            template<typename T>
+            Connection connect_on_remove_batch(std::function<void(std::span<const Entity>)> function) {
+                return observers_of(Types::type_id<T>()).on_remove_batch.connect(function);
+            }
+
+            template<typename T>
+            bool disconnect_on_remove_batch(Connection connection) {
+                size_t id = Types::type_id<T>();
+                return id < observers.size() && observers[id].on_remove_batch.disconnect(connection);
+            }
+
+            /*
+                Delivers the entities collected for the batch observers,
+                one call per component type and kind of change. Changes
+                the observers make to the set are delivered by the next flush.
+            */
+            void flush_observers();
+
         private:
 
+            /*
+                A resource and how to destroy it without knowing its type.
+            */
+            struct ResourceSlot {
+                void* value = nullptr;
+                void (*destroy)(void*) = nullptr;
+            };
+
+            /*
+                Everything that observes a single component type. The batches
+                only collect entities while a batch function is connected.
+            */
+            struct Observers {
+                Signal<Entity> on_insert;
+                Signal<Entity> on_remove;
+                Signal<std::span<const Entity>> on_insert_batch;
+                Signal<std::span<const Entity>> on_remove_batch;
+                std::vector<Entity> inserted;
+                std::vector<Entity> removed;
+            };
+
+            /*
+                Adds a new archetype made from the given storages and
+                tags and returns its index. The archetype takes ownership
+                of the storages.
+            */
+            size_t create_archetype(std::vector<BaseStorage*>& storage_pointers, const std::vector<size_t>& tag_ids = {});
+
+            /*
+                Returns the observers of a component, making room for them if needed.
+                The component counts as observed from then on.
+            */
+            inline Observers& observers_of(size_t id) {
+                if(id >= observers.size()) {
+                    observers.resize(id + 1);
+                }
+                observed.add(id);
+                return observers[id];
+            }
+
+            inline void emit_on_remove(size_t id, Entity entity) {
+                if(observed.contains(id)) {
+                    Observers& component_observers = observers[id];
+                    component_observers.on_remove.emit(entity);
+                    if(!component_observers.on_remove_batch.empty()) {
+                        component_observers.removed.push_back(entity);
+                    }
+                }
+            }
+
+            inline void emit_on_insert(size_t id, Entity entity) {
+                if(observed.contains(id)) {
+                    Observers& component_observers = observers[id];
+                    component_observers.on_insert.emit(entity);
+                    if(!component_observers.on_insert_batch.empty()) {
+                        component_observers.inserted.push_back(entity);
+                    }
+                }
+            }
+
+            /*
+                Same as above for many entities. The entities must not be
+                inside an archetype, since the observers could change it.
+            */
+            void emit_on_insert(size_t id, std::span<const Entity> entities);
+
+            /*
+                Creates count entities at the end of the archetype of the
+                given components, without telling the observers. Returns
+                the archetype, the new entities are its last count rows.
+            */
+            template<typename... Ts>
+            Archetype& create_rows(size_t count, const Ts&... prototypes) {
+
+                size_t archetype_index = archetype_of<Ts...>();
+                Archetype& archetype = archetypes[archetype_index];
+                size_t first_offset = archetype.count();
+
+                //construct the components in place, one column at a time
+                ((push_back_copies(archetype, count, prototypes)), ...);
+
+                //hand out the ids
+                archetype.offset_to_entity.reserve(first_offset + count);
+                if(count > free_indices.size()) {
+                    entity_slots.reserve(entity_slots.size() + count - free_indices.size());
+                }
+                for(size_t i = 0; i < count; i++) {
+                    archetype.offset_to_entity.push_back(allocate_entity(archetype_index, first_offset + i));
+                }
+                return archetype;
+            }
+
+            /*
+                Puts a component at the end of a storage, or over the one at
+                the offset, and stamps it with the current tick.
+            */
+            inline void insert_new(BaseStorage* storage, void* component) {
+                storage->push_back(component);
+                storage->push_ticks(change_tick, change_tick);
+            }
+
+            inline void insert_existing(BaseStorage* storage, size_t offset, void* component) {
+                storage->set_component(offset, component);
+                storage->set_changed_tick(offset, change_tick);
+            }
+
+            /*
+                Returns the thread pool, creating it the
+                first time it's needed.
+            */
+            ThreadPool& thread_pool();
+
+            /*
+                Splits the entities of the archetypes into row ranges,
+                small enough to keep every worker of the thread pool busy.
+            */
+            std::vector<RowRange> split_rows(const std::vector<Archetype*>& matching);
+
+            /*
+                Returns a query over the archetypes that contain the signature
+                and none of the excluded components. The query is owned by
+                the set and kept up to date, so the list of archetypes is only
+                built once per signature.
+            */
+            BaseQuery& cached_query(FastSignature signature, FastSignature excluded = FastSignature());
+
+            struct QueryKeyHasher {
+                size_t operator()(const std::pair<FastSignature, FastSignature>& key) const {
+                    return key.first.hash() * 31 + key.second.hash();
+                }
+            };
+
+            template<typename...> friend class EntityIterator;
+
+            /*
+                Returns the index of the archetype that has exactly
+                the given components, creating it if it doesn't exist.
+            */
+            template<typename... Ts>
+            size_t archetype_of() {
+                FastSignature signature;
+                ((signature.add(Types::type_id<Ts>())), ...);
+                size_t archetype_index = find_archetype(signature);
+                if(archetype_index == -1) {
+                    std::vector<BaseStorage*> storage_pointers;
+                    std::vector<size_t> tag_ids;
+                    ((add_column<Ts>(storage_pointers, tag_ids)), ...);
+                    archetype_index = create_archetype(storage_pointers, tag_ids);
+                }
+                return archetype_index;
+            }
+
+            /*
+                Returns the index of the archetype with the components of the given
+                archetype plus the given ones, creating it if it doesn't exist.
+                Single component transitions are cached as edges.
+            */
+            template<typename... Ts>
+            size_t archetype_with(size_t archetype_index) {
+
+                Archetype& current_archetype = archetypes[archetype_index];
+                size_t missing_count = 0;
+                size_t missing_id = 0;
+                ((current_archetype.has_component<Ts>() ? void() : (void)(missing_count++, missing_id = Types::type_id<Ts>())), ...);
+                if(missing_count == 0) {
+                    return archetype_index;
+                }
+
+                //a single new component might be a transition we have already made before
+                if(missing_count == 1) {
+                    auto edge = current_archetype.add_edges.find(missing_id);
+                    if(edge != current_archetype.add_edges.end()) {
+                        return edge->second;
+                    }
+                }
+
+                //check if there is a archetype that fits the spec of the new entity
+                FastSignature signature = current_archetype.fast_signature;
+                ((signature.add(Types::type_id<Ts>())), ...);
+                size_t new_archetype_index = find_archetype(signature);
+
+                //couldn't find a archetype, we need to create one
+                if(new_archetype_index == -1) {
+                    std::vector<BaseStorage*> storage_pointers;
+                    std::vector<size_t> tag_ids = current_archetype.tag_indices;
+                    for(size_t compound_id : current_archetype.compound_indices) {
+                        storage_pointers.push_back(current_archetype.compound[compound_id]->make_empty_copy());
+                    }
+                    ((current_archetype.has_component<Ts>() ? void() : add_column<Ts>(storage_pointers, tag_ids)), ...);
+                    new_archetype_index = create_archetype(storage_pointers, tag_ids);
+                }
+
+                //remember single component transitions, so the next insert is a single lookup
+                if(missing_count == 1) {
+                    archetypes[archetype_index].add_edges[missing_id] = new_archetype_index;
+                    archetypes[new_archetype_index].remove_edges[missing_id] = archetype_index;
+                }
+                return new_archetype_index;
+            }
+
+            /*
+                Adds a new storage of the component to the storages,
+                or its id to the tag ids if it's a tag.
+            */
+            template<typename T>
+            static void add_column(std::vector<BaseStorage*>& storage_pointers, std::vector<size_t>& tag_ids) {
+                if constexpr(is_tag<T>) {
+                    tag_ids.push_back(Types::type_id<T>());
+                } else {
+                    storage_pointers.push_back(new StorageOf<T>());
+                }
+            }
+
+            /*
+                Copies the prototype over the components at the offsets.
+                Tags have nothing to copy, here and below.
+            */
+            template<typename T>
+            void overwrite_rows(Archetype& archetype, const std::vector<size_t>& offsets, const T& prototype) {
+                if constexpr(!is_tag<T>) {
+                    BaseStorage* storage = archetype.compound[Types::type_id<T>()];
+                    for(size_t offset : offsets) {
+                        *(T*)storage->get_component_pointer(offset) = prototype;
+                        storage->set_changed_tick(offset, change_tick);
+                    }
+                }
+            }
+
+            /*
+                Copy constructs count components from the prototype at the end
+                of the component's storage, stamped with the current tick.
+            */
+            template<typename T>
+            void push_back_copies(Archetype& archetype, size_t count, const T& prototype) {
+                if constexpr(!is_tag<T>) {
+                    BaseStorage* storage = archetype.compound[Types::type_id<T>()];
+                    ((StorageOf<T>*)storage)->push_back_copies(count, prototype);
+                    storage->push_ticks(change_tick, change_tick, count);
+                }
+            }
+
+            /*
+                Stores a component of the entity at the offset, either
+                as a new one or over the one it already has.
+            */
+            template<typename T>
+            inline void insert_component(Archetype& archetype, size_t offset, bool had_component, T& component) {
+                if constexpr(!is_tag<T>) {
+                    BaseStorage* storage = archetype.compound[Types::type_id<T>()];
+                    had_component ? insert_existing(storage, offset, &component) : insert_new(storage, &component);
+                }
+            }
+
+            /*
+                Gives out a new entity id, reusing removed indices first.
+                The entity is placed at the given offset in the given archetype,
+                but the archetype itself is left for the caller to update.
+            */
+            Entity allocate_entity(size_t archetype_index, size_t offset);
+
+            /*
+                Returns the slot of an entity, or nullptr if the entity
+                doesn't exist. Stale entities whose index has been
+                reused by a newer generation don't exist either.
+            */
+            inline EntitySlot* find_slot(Entity entity) {
+                size_t index = entity_index(entity);
+                if(index < entity_slots.size()) {
+                    EntitySlot& slot = entity_slots[index];
+                    if(slot.archetype_index != -1 && slot.generation == entity_generation(entity)) {
+                        return &slot;
+                    }
+                }
+                return nullptr;
+            }
+
+            /*
+                Moves an entity and all of its components that also exist in
+                the destination archetype from its current archetype to another. References
+                are moved along with the components. Components that don't exist
+                in the destination are destroyed and their references become invalid.
+            */
+            void move_entity(Entity entity, size_t to_index);
+
+            /*
+                Moves the entities at the offsets, which must be sorted and unique,
+                the same way move_entity does, but copies runs of consecutive rows
+                at once and fills the holes they leave in a single pass.
+            */
+            void move_rows(size_t from_index, const std::vector<size_t>& offsets, size_t to_index);
+
+            /*
+                Removes the entity at the given offset from an archetype
+                and updates the slot of the entity that took its place.
+            */
+            void remove_from_archetype(size_t archetype_index, size_t offset);
+
+            /*
+                Returns the reference data of the component at the offset,
+                taking a new one from the pool if it isn't referenced yet.
+            */
             ReferenceData* reference_data(BaseStorage* storage, size_t offset);
-            void swap_reference_data(BaseStorage* old_storage, uint64_t old_offset, BaseStorage* new_storage, uint64_t new_offset);
-            void delete_reference_pointer(ReferenceData* reference_data);
-            void make_reference_data_pointer_null(BaseStorage* storage, uint64_t offset);
-            void make_reference_entity_null(BaseStorage* storage, uint64_t offset);
+
+            /*
+                Gives reference data that is no longer referenced back to the pool.
+            */
+            void release_reference_data(ReferenceData* reference_data);
+            /*
+                Adds a query to the queries that are told about
+                new archetypes, and gives it every archetype
+                that already exists.
+            */
+            void register_query(BaseQuery* query);
+            void unregister_query(BaseQuery* query);
+
             friend class BaseReference;
+            friend class BaseQuery;
+            friend class CommandBuffer;
             friend Archetype;
 
-            //counter for all the entites that have been spawned
-            //starts at 1, since 0 is the "null" entity.
-            size_t entity_counter = 1;
+            //all the archetypes. A deque, so pointers to
+            //the archetypes stay valid when new ones are added
+            std::deque<Archetype> archetypes;
+
+            //the queries that need to know about new archetypes
+            std::vector<BaseQuery*> queries;
+
+            //the queries used by iterator, each_chunk and par_each,
+            //one per signature and excluded components
+            std::unordered_map<std::pair<FastSignature, FastSignature>, std::unique_ptr<BaseQuery>, QueryKeyHasher> cached_queries;
+
+            //the tick that inserts and changes are stamped with.
+            //starts at 1, so filtering on tick 0 gives everything.
+            uint32_t change_tick = 1;
+
+            //the workers used by the parallel iteration
+            std::unique_ptr<ThreadPool> workers;
+            size_t worker_count = 0;
+
+            //ranges smaller than this aren't worth the cost of another job
+            static constexpr size_t min_rows_per_job = 1024;
+
+            //archetype indices bucketed by their signature hash
+            std::unordered_map<size_t, std::vector<size_t>> signature_to_archetypes;
+
+            //observers, indexed by component id. Only as long as the highest observed id. A deque,
+            //so connecting from inside an observer doesn't move the one being called.
+            //The ids that have had observers are kept too, so unobserved changes cost a single check
+            std::deque<Observers> observers;
+            FastSignature observed;
+
+            //all the entities that exist inside this Set instance, indexed by the entity index.
+            //starts with a slot for the "null" entity, which never exists.
+            //each slot tells which archetype index it uses in the vector above and its offset there
+            std::vector<EntitySlot> entity_slots;
+
+            //indices of removed entities that can be reused by new entities
+            std::vector<size_t> free_indices;
 
-            //all the archetypes
-            std::vector<Archetype> archetypes;
+            //the entities returned by the last create_many_span
+            std::vector<Entity> created_entities;
 
-            //signals
-            Signal<Entity> on_remove_signals[MAX_COMPONENTS];
+            //the counters reported by stats
+            size_t migrations = 0;
+            size_t swap_removes = 0;
+            size_t find_archetype_misses = 0;
 
-            //all the entities that exist inside this Set instance.
-            //the value is which archetype index it uses in the vector above
-            std::unordered_map<Entity, size_t> entities;
+            //the resources, indexed by type id. Only as long as the highest id with a resource
+            std::vector<ResourceSlot> resources;
 
-            //lookups for all the references that exists
-            std::unordered_map<uint64_t, ReferenceData*> sid_to_reference_data;
-            std::unordered_set<ReferenceData*> reference_datas;
+            //the slab blocks the reference datas are taken from, and the datas that are free
+            std::vector<ReferenceBlock*> reference_blocks;
+            std::vector<ReferenceData*> free_reference_datas;
     };
+
+    template<typename... T>
+    template<typename U>
+    U* EntityIterator<T...>::find_resource() {
+        return query->m_set ? query->m_set->template resource<U>() : nullptr;
+    }
+
+    template<typename... T>
+    template<typename... Excluded>
+    EntityIterator<T...> EntityIterator<T...>::without() {
+
+        //a query that outlived its set has nothing left to filter
+        if(!query->m_set) {
+            return *this;
+        }
+        FastSignature excluded = query->m_excluded;
+        ((excluded.add(Types::type_id<Excluded>())), ...);
+        BaseQuery& filtered = query->m_set->cached_query(query->m_signature, excluded);
+        EntityIterator<T...> it = *this;
+        it.query = &filtered;
+        it.archetypes = &filtered.m_archetypes;
+        return it;
+    }
+
+    template<typename... T>
+    template<typename U>
+    EntityIterator<T...> EntityIterator<T...>::changed(uint32_t since) {
+        return with_tick_filter<U>(since, false);
+    }
+
+    template<typename... T>
+    template<typename U>
+    EntityIterator<T...> EntityIterator<T...>::added(uint32_t since) {
+        return with_tick_filter<U>(since, true);
+    }
+
+    template<typename... T>
+    template<typename U>
+    EntityIterator<T...> EntityIterator<T...>::with_tick_filter(uint32_t since, bool added) {
+        static_assert(!is_tag<U>, "tags have no ticks");
+        if(!query->m_set) {
+            return *this;
+        }
+
+        //the component has to exist to have ticks
+        FastSignature signature = query->m_signature;
+        if(!signature.contains(Types::type_id<U>())) {
+            signature.add(Types::type_id<U>());
+        }
+        BaseQuery& filtered = query->m_set->cached_query(signature, query->m_excluded);
+
+        EntityIterator<T...> it = *this;
+        it.query = &filtered;
+        it.archetypes = &filtered.m_archetypes;
+        it.filters.push_back({Types::type_id<U>(), since, added, nullptr});
+        return it;
+    }
 }
\ No newline at end of file
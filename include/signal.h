@@ -1,91 +1,78 @@
 #pragma once
-#include <vector>
-#include <functional>  
+#include <deque>
+#include <functional>
 
 namespace eset {
-    
+
+    //identifies a function connected to a signal, see Signal::connect.
+    //0 is never handed out, so it can be used for "not connected".
+    using Connection = size_t;
+
     template<typename... T>
     class Signal {
 
         public:
-            void connect(std::function<void(T...)> func) {
 
-                FunctionSignature signature;
-                signature.type_id = typeid(func).hash_code();
-                signature.instance_pointer = nullptr;
-                signature.function = func;
-
-                add(signature);
+            /*
+                Connects a function and returns the connection
+                that disconnects it again. Every call adds the
+                function, even if an equal one is connected.
+            */
+            Connection connect(std::function<void(T...)> func) {
+                return add(std::move(func));
             }
 
             template<typename Function, typename InstanceType>
-            void connect(Function func, InstanceType& instance) {
-
-                FunctionSignature signature;
-                signature.type_id = typeid(func).hash_code();
-                signature.instance_pointer = (void*)&instance;
-                signature.function = std::bind(func, &instance, (typeid(T), std::placeholders::_1)...);
-
-                add(signature);
+            Connection connect(Function func, InstanceType& instance) {
+                return add(std::bind(func, &instance, (typeid(T), std::placeholders::_1)...));
             }
 
-            void disconnect(std::function<void(T...)> func) {
-                FunctionSignature signature;
-                signature.type_id = typeid(func).hash_code();
-                signature.instance_pointer = nullptr;
+            /*
+                Disconnects the function of a connection.
+                Returns false if it isn't connected.
+            */
+            bool disconnect(Connection connection) {
+                for(size_t i = 0; i < functions.size(); i++) {
+                    if(functions[i].connection == connection) {
 
-                remove(signature);
+                        //function found. remove it and break
+                        functions.erase(functions.begin() + i);
+                        return true;
+                    }
+                }
+                return false;
             }
 
-            template<typename Function, typename InstanceType>
-            void disconnect(Function func, InstanceType& instance) {
-
-                FunctionSignature signature;
-                signature.type_id = typeid(func).hash_code();
-                signature.instance_pointer = (void*)&instance;
+            void emit(T... values) {
 
-                remove(signature);
+                //by index, so functions can connect others while being called. The functions
+                //are in a deque, so connecting doesn't move the one that is running.
+                //Disconnecting from inside a function isn't supported.
+                for(size_t i = 0; i < functions.size(); i++) {
+                    functions[i].function(values...);
+                }
             }
 
-            void emit(T... values) {
-                for(auto signature : functions) {
-                    signature.function(values...);
-                }
+            /*
+                Returns true if nothing is connected.
+            */
+            bool empty() const {
+                return functions.empty();
             }
 
         private:
 
-            struct FunctionSignature {
-                size_t type_id;
-                void* instance_pointer;
+            struct ConnectedFunction {
+                Connection connection;
                 std::function<void(T...)> function;
             };
 
-            void add(FunctionSignature& signature) {
-
-                bool exist = false;
-                for(auto other_signature : functions) {
-                    if(other_signature.type_id == signature.type_id && other_signature.instance_pointer == signature.instance_pointer) {
-                        exist = true;
-                        break;
-                    }
-                }
-                if(!exist) {
-                    functions.push_back(signature);
-                }
-            }
-
-            void remove(FunctionSignature& signature) {
-                for(size_t i = 0; i < functions.size(); i++) {
-                    if(functions[i].type_id == signature.type_id && functions[i].instance_pointer == signature.instance_pointer) {
-                        
-                        //function found. remove it and break
-                        functions.erase(functions.begin() + i);
-                        break;
-                    }
-                }
+            Connection add(std::function<void(T...)> function) {
+                functions.push_back({++last_connection, std::move(function)});
+                return last_connection;
             }
 
-            std::vector<FunctionSignature> functions;
+            std::deque<ConnectedFunction> functions;
+            Connection last_connection = 0;
     };
 }
\ No newline at end of file
@@ -0,0 +1,61 @@
+#pragma once
+#include <vector>
+#include <string_view>
+#include "types.h"
+
+namespace eset {
+
+    /*
+        The memory of one component column of an archetype. The bytes
+        include the change ticks and references stored next to the
+        components. Slack is the reserved but unused part of the bytes.
+    */
+    struct ColumnStats {
+        size_t component_id;
+        std::string_view name;
+        size_t component_size;
+        size_t count;
+        size_t capacity;
+        size_t bytes;
+        size_t slack_bytes;
+    };
+
+    /*
+        One archetype. Its columns are the column_count
+        columns from first_column in SetStats::columns.
+    */
+    struct ArchetypeStats {
+        size_t index;
+        size_t entities;
+        size_t first_column;
+        size_t column_count;
+        size_t bytes;
+        size_t slack_bytes;
+    };
+
+    /*
+        A snapshot of what is inside a set, see Set::stats.
+        The counters add up from the creation of the set,
+        or the last Set::reset_counters.
+    */
+    struct SetStats {
+        size_t archetype_count = 0;
+        size_t empty_archetype_count = 0;
+        size_t entity_count = 0;
+
+        //every byte owned by the archetypes and the entity bookkeeping, and the unused part
+        size_t bytes = 0;
+        size_t slack_bytes = 0;
+
+        size_t live_references = 0;
+
+        //entities moved between archetypes, rows removed by swapping in
+        //the last row, and archetype lookups that found nothing
+        size_t migrations = 0;
+        size_t swap_removes = 0;
+        size_t find_archetype_misses = 0;
+
+        std::vector<ArchetypeStats> archetypes;
+        std::vector<ColumnStats> columns;
+    };
+}
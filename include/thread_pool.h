@@ -0,0 +1,69 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+
+namespace eset {
+
+    /*
+        A small work stealing thread pool. Every worker has its own
+        queue of jobs, and a worker that runs out of jobs steals
+        from the back of the other workers' queues.
+    */
+    class ThreadPool {
+
+        public:
+
+            /*
+                Creates a pool that runs jobs on worker_count threads,
+                counting the thread that calls run. A worker count of 0
+                uses one worker per hardware thread.
+            */
+            ThreadPool(size_t worker_count = 0);
+            ~ThreadPool();
+
+            /*
+                Returns the amount of threads that run jobs,
+                including the thread that calls run.
+            */
+            size_t worker_count();
+
+            /*
+                Calls job(i) for every i from 0 up to job_count, spread
+                over the workers, and returns once all of them are done.
+                The calling thread works on the jobs too. Jobs must not
+                throw or call run on the same pool.
+            */
+            void run(size_t job_count, const std::function<void(size_t)>& job);
+
+        private:
+
+            struct JobQueue {
+                std::mutex mutex;
+                std::deque<size_t> jobs;
+            };
+
+            void worker_loop(size_t queue_index);
+            void work(size_t queue_index);
+            bool pop(size_t queue_index, size_t& job_index);
+            bool steal(size_t queue_index, size_t& job_index);
+
+            std::vector<std::thread> m_threads;
+            std::vector<std::unique_ptr<JobQueue>> m_queues;
+
+            //the current job. Guarded by m_mutex together with the generation
+            const std::function<void(size_t)>* m_job = nullptr;
+            size_t m_generation = 0;
+            size_t m_active = 0;
+            bool m_stop = false;
+
+            std::mutex m_mutex;
+            std::mutex m_run_mutex;
+            std::condition_variable m_wake;
+            std::condition_variable m_done;
+    };
+}
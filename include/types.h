@@ -1,28 +1,220 @@
 #pragma once
 #include <stdlib.h>
 #include <cstdint>
+#include <iosfwd>
+#include <string_view>
+#include <type_traits>
 
 namespace eset {
 
+    //the most component types a program can use. Set it with the ESET_MAX_COMPONENTS
+    //cmake option, which the library exports to everything that links to it. The
+    //layouts of the signatures, archetypes and sets depend on it, so every part of
+    //a program has to use the value the library was built with.
+    #ifndef ESET_MAX_COMPONENTS
+    #define ESET_MAX_COMPONENTS 256
+    #endif
+    #if defined(MAX_COMPONENTS) && MAX_COMPONENTS != ESET_MAX_COMPONENTS
+    #error "MAX_COMPONENTS differs from the library's ESET_MAX_COMPONENTS, use the cmake option instead"
+    #endif
+    #ifndef MAX_COMPONENTS
+    #define MAX_COMPONENTS ESET_MAX_COMPONENTS
+    #endif
+    static_assert(MAX_COMPONENTS % 64 == 0, "MAX_COMPONENTS must be a multiple of 64");
+
     //Entity definition, it's just a size_t
-    #define MAX_COMPONENTS 256
+    //the lower 32 bits are the entity's index and the upper 32 bits
+    //are its generation, which increases every time the index is reused.
     using Entity = size_t;
     static const Entity null = 0;
 
+    /*
+        Returns the index part of an entity.
+    */
+    inline size_t entity_index(Entity entity) {
+        return entity & 0xFFFFFFFF;
+    }
+
+    /*
+        Returns the generation part of an entity.
+    */
+    inline uint32_t entity_generation(Entity entity) {
+        return (uint32_t)(entity >> 32);
+    }
+
+    /*
+        Combines an index and a generation into an entity.
+    */
+    inline Entity make_entity(size_t index, uint32_t generation) {
+        return ((Entity)generation << 32) | index;
+    }
+
+    class BaseStorage;
+    template<typename ComponentType> struct StorageType;
+
+    /*
+        Empty types are tags. They only mark entities, so an archetype
+        keeps them in its signature and doesn't give them a storage.
+        Empty types that do something when they are copied or destroyed
+        are stored like any other component, so their lifetimes still count.
+    */
+    template<typename T>
+    inline constexpr bool is_tag = std::is_empty_v<T> && std::is_trivially_copyable_v<T> && std::is_trivially_destructible_v<T>;
+
+    /*
+        The instance every entity with the tag shares.
+    */
+    template<typename T>
+    inline T& tag_instance() {
+        static T instance;
+        return instance;
+    }
+
+    /*
+        What the set knows about a component type, without
+        knowing the type itself.
+    */
+    struct ComponentInfo {
+        std::string_view name;
+        uint64_t hash;
+        size_t size;
+        size_t alignment;
+        bool trivially_copyable;
+        bool trivially_destructible;
+        bool tag;
+
+        //makes an empty storage of the type. Never used for tags
+        BaseStorage* (*make_storage)();
+
+        //writes a component to a stream and reads count components from one to the
+        //end of a storage. Only set for types with a serializer, see Types::set_serializer
+        void (*save)(const void* component, std::ostream& out) = nullptr;
+        bool (*load)(std::istream& in, BaseStorage* storage, size_t count) = nullptr;
+    };
+
     class Types {
         public:
             /*
-                Returns a unique id for a certain
-                        component.
+                Returns the name of a type as the compiler spells it.
+                The same type gives the same name on every run of the same build.
+            */
+            template<typename T>
+            static constexpr std::string_view type_name() {
+            #if defined(_MSC_VER) && !defined(__clang__)
+                std::string_view name = __FUNCSIG__;
+                size_t start = name.find("type_name<") + 10;
+                size_t end = name.rfind(">(void)");
+            #else
+                //"... type_name() [with T = Type; ...]" on gcc and "... type_name() [T = Type]" on clang
+                std::string_view name = __PRETTY_FUNCTION__;
+                size_t start = name.find("T = ") + 4;
+                size_t end = name.find(';', start);
+                if(end == std::string_view::npos) {
+                    end = name.rfind(']');
+                }
+            #endif
+                return name.substr(start, end - start);
+            }
+
+            /*
+                Returns a stable identifier of a type, made by hashing its
+                name with FNV-1a. Unlike type_id, it doesn't depend on the order
+                types are first used in, so it can be saved to files.
+                Types are told apart by name only, so two types with the same
+                name, for example in anonymous namespaces, both get their own
+                type_id, but can't be found by their hash or saved.
+            */
+            template<typename T>
+            static constexpr uint64_t type_hash() {
+                uint64_t hash = 14695981039346656037ull;
+                for(char c : type_name<T>()) {
+                    hash = (hash ^ (uint8_t)c) * 1099511628211ull;
+                }
+                return hash;
+            }
+
+            /*
+                Returns a unique id for a certain component. The ids
+                are dense, starting at 0, so they can index arrays of
+                MAX_COMPONENTS. Registering happens once per type and
+                is thread safe. After that the id is a single load.
+                Registering more than MAX_COMPONENTS types, or two types
+                whose different names have the same hash, aborts.
             */
             template<typename T>
             static size_t type_id() {
-                static size_t id = component_counter++;
+                static const size_t id = register_type(make_info<T>());
                 return id;
             }
 
+            /*
+                Returns the info of the component with the given id.
+            */
+            static const ComponentInfo& info(size_t id);
+
+            /*
+                Returns the id of the component with the given stable
+                hash, or -1 if no such type has been registered, or
+                several types with the same name have.
+            */
+            static size_t id_of_hash(uint64_t hash);
+
+            /*
+                Returns the amount of registered component types.
+            */
+            static size_t count();
+
+            /*
+                Tells Set::save and Set::load how to write and read a component
+                type that isn't trivially copyable. Those are copied as raw bytes,
+                every other type in a saved set needs a serializer. The type must
+                be default constructible. Set serializers before saving or loading,
+                it isn't thread safe with those.
+
+                void save_name(const Name& name, std::ostream& out) { ... }
+                bool load_name(std::istream& in, Name& name) { ... return in.good(); }
+                eset::Types::set_serializer<Name, save_name, load_name>();
+            */
+            template<typename T, void (*Save)(const T&, std::ostream&), bool (*Load)(std::istream&, T&)>
+            static void set_serializer() {
+                set_serializer(type_id<T>(),
+                    [](const void* component, std::ostream& out) {
+                        Save(*(const T*)component, out);
+                    },
+                    [](std::istream& in, BaseStorage* storage, size_t count) {
+                        for(size_t i = 0; i < count; i++) {
+                            T component{};
+                            if(!Load(in, component)) {
+                                return false;
+                            }
+                            ((typename StorageType<T>::type*)storage)->push_back(&component);
+                        }
+                        return true;
+                    });
+            }
+
         private:
-            //component counter
-            static size_t component_counter;
+
+            template<typename T>
+            static ComponentInfo make_info() {
+                ComponentInfo info;
+                info.name = type_name<T>();
+                info.hash = type_hash<T>();
+                info.size = sizeof(T);
+                info.alignment = alignof(T);
+                info.trivially_copyable = std::is_trivially_copyable_v<T>;
+                info.trivially_destructible = std::is_trivially_destructible_v<T>;
+                info.tag = is_tag<T>;
+                info.make_storage = []() -> BaseStorage* { return new typename StorageType<T>::type(); };
+                return info;
+            }
+
+            /*
+                Gives the type of the info the next id. Only
+                called once per type, by type_id.
+            */
+            static size_t register_type(const ComponentInfo& info);
+
+            static void set_serializer(size_t id, void (*save)(const void*, std::ostream&), bool (*load)(std::istream&, BaseStorage*, size_t));
     };
 }
\ No newline at end of file
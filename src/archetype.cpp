@@ -1,29 +1,36 @@
 #include "archetype.h"
 #include "set.h"
 #include <cassert>
+#include <algorithm>
 
 using namespace eset;
 
 Archetype::Archetype(Archetype&& other) {
-    entity_to_offset = std::move(other.entity_to_offset);
     offset_to_entity = std::move(other.offset_to_entity);
+    add_edges = std::move(other.add_edges);
+    remove_edges = std::move(other.remove_edges);
     compound_indices = std::move(other.compound_indices);
-    for(size_t compound_id : compound_indices) {
-        compound[compound_id] = other.compound[compound_id];
-        other.compound[compound_id] = nullptr;
-    }
+    compound = std::move(other.compound);
+    tag_indices = std::move(other.tag_indices);
     fast_signature = other.fast_signature;
     other.fast_signature.clear();
 }
 
-Archetype::Archetype(std::vector<BaseStorage*>& storage_pointers) {
+Archetype::Archetype(std::vector<BaseStorage*>& storage_pointers, const std::vector<size_t>& tag_ids) {
 
     for(BaseStorage* storage : storage_pointers) {
         size_t id = storage->get_component_type_id();
+        if(id >= compound.size()) {
+            compound.resize(id + 1, nullptr);
+        }
         compound[id] = storage;
         compound_indices.push_back(id);
         fast_signature.add(id);
     }
+    for(size_t id : tag_ids) {
+        tag_indices.push_back(id);
+        fast_signature.add(id);
+    }
 }
 
 Archetype::~Archetype() {
@@ -35,142 +42,123 @@ Archetype::~Archetype() {
     }
 }
 
-void Archetype::remove_entity(Entity entity, Set* set) {
+//makes the reference to a component that is being destroyed, if any, invalid
+static void invalidate_reference(BaseStorage* storage, size_t offset) {
+    ReferenceData* reference_data = storage->reference(offset);
+    if(reference_data) {
+        reference_data->m_storage = nullptr;
+        reference_data->m_offset = 0;
+        reference_data->m_entity = null;
+        storage->set_reference(offset, nullptr);
+    }
+}
+
+Entity Archetype::remove_entity(size_t offset) {
 
     //since we check if the entity exist in the set, it should exist here too.
     //therefore, we don't need to check again inside this Archetype
-    size_t offset = entity_to_offset[entity];
+    size_t last_offset = offset_to_entity.size() - 1;
 
     //we are at the end
-    if(offset == offset_to_entity.size() - 1) {
+    if(offset == last_offset) {
         //remove all the components and swap end components
         for(size_t id : compound_indices) {
-            if(set) {
-                set->on_remove_signals[id].emit(entity);
-                set->make_reference_entity_null(compound[id], offset);
-                set->make_reference_data_pointer_null(compound[id], offset);
-            }
-            compound[id]->remove_end();
+            invalidate_reference(compound[id], offset);
+            compound[id]->swap_remove(offset);
+            compound[id]->remove_ticks(offset);
         }
-        entity_to_offset.erase(entity);
         offset_to_entity.pop_back();
+        return null;
 
     } else {
 
         //remove all the components and swap end components
         for(size_t id : compound_indices) {
 
-            if(set) {
-
-                //component's end of lifetime setup
-                set->on_remove_signals[id].emit(entity);
-                set->make_reference_entity_null(compound[id], offset);
-                set->make_reference_data_pointer_null(compound[id], offset);
-
-                //change reference data for the last offset that is being swapped to the middle of the storage before removing
-                uint64_t last_offset = compound[id]->get_component_count(); //this is not being removed
-                set->swap_reference_data(compound[id], last_offset, compound[id], offset);
-            }
-
-            compound[id]->move_from_end(offset);
-            compound[id]->remove_end();
+            //the reference of the last component follows it to the offset in remove_ticks
+            invalidate_reference(compound[id], offset);
+            compound[id]->swap_remove(offset);
+            compound[id]->remove_ticks(offset);
         }
 
         //copy the last entity to this entity's offset
-        size_t last_entity_offset = offset_to_entity.size()-1;
-        Entity last_entity = offset_to_entity[last_entity_offset];
-        entity_to_offset[last_entity] = offset;
+        Entity last_entity = offset_to_entity[last_offset];
         offset_to_entity[offset] = last_entity;
-
-        //then remove this entity
-        entity_to_offset.erase(entity);
         offset_to_entity.pop_back(); //since we "swaped", we delete the last element now
+        return last_entity;
     }
 }
 
-void Archetype::insert_entity(Entity entity) {
-    size_t new_offset = offset_to_entity.size();
-    entity_to_offset.emplace(entity, new_offset);
-    offset_to_entity.push_back(entity);
-
-    /*for(size_t id : compound_indices) {
-        compound[id]->insert_default_end();
-    }*/
-}
+size_t Archetype::remove_rows(const std::vector<size_t>& offsets, Set* set) {
 
-ArchetypeSignature Archetype::get_archetype_signature() {
-    ArchetypeSignature signature;
+    size_t remaining = offset_to_entity.size() - offsets.size();
 
-    //remove all the components and swap end components
+    //the removed components that are still referenced are destroyed
     for(size_t id : compound_indices) {
-        signature.add(id, compound[id]->get_component_size());
-    }
-
-    return signature;
-}
-
-FastSignature Archetype::get_fast_signature() {
-    return fast_signature;
-}
-
-//signature functions
-size_t ArchetypeSignature::count() {
-    return m_count;
-}
-
-void ArchetypeSignature::add(size_t id, size_t size) {
-
-    //assert(m_count < 32);
-
-    m_ids[m_count] = id;
-    m_sizes[m_count] = size;
-    m_count++;
-}
-
-bool ArchetypeSignature::operator==(ArchetypeSignature& rhs) {
-
-    if(m_count != rhs.m_count) {
-        return false;
+        if(compound[id]->has_references()) {
+            for(size_t offset : offsets) {
+                invalidate_reference(compound[id], offset);
+            }
+        }
     }
 
-    for(size_t self = 0; self < m_count; self++) {
+    //fill the removed rows in front of the remaining count with the kept rows behind it,
+    //moving runs of consecutive rows at once
+    size_t hole = 0;
+    size_t removed_behind = std::lower_bound(offsets.begin(), offsets.end(), remaining) - offsets.begin();
+    size_t filler = remaining;
+    while(hole < offsets.size() && offsets[hole] < remaining) {
+
+        //skip the rows behind the remaining count that are removed themselves
+        while(removed_behind < offsets.size() && offsets[removed_behind] == filler) {
+            removed_behind++;
+            filler++;
+        }
 
-        bool exist = false;
-        for(size_t other = 0; other < rhs.m_count; other++) {
-            if(m_ids[self] == rhs.m_ids[other]) {
-                exist = true;
-                break;
-            }
+        //extend the run while both the holes and the kept rows are consecutive
+        size_t destination = offsets[hole];
+        size_t run = 1;
+        while(hole + run < offsets.size() && offsets[hole + run] == destination + run && destination + run < remaining &&
+              !(removed_behind < offsets.size() && offsets[removed_behind] == filler + run)) {
+            run++;
         }
+        hole += run;
 
-        if(!exist) {
-            return false;
+        for(size_t id : compound_indices) {
+            compound[id]->move_range(destination, filler, run);
+            compound[id]->move_ticks(destination, filler, run);
         }
+        for(size_t i = 0; i < run; i++) {
+            Entity entity = offset_to_entity[filler + i];
+            offset_to_entity[destination + i] = entity;
+            set->entity_slots[entity_index(entity)].offset = destination + i;
+        }
+        filler += run;
     }
 
-    return true;
-}
-
-bool ArchetypeSignature::contains(ArchetypeSignature& other) {
-
-    if(m_count < other.m_count) {
-        return false;
+    for(size_t id : compound_indices) {
+        compound[id]->truncate(remaining);
+        compound[id]->truncate_ticks(remaining);
     }
+    offset_to_entity.resize(remaining);
+    return hole;
+}
 
-    for(size_t o = 0; o < other.m_count; o++) {
-
-        bool exist = false;
-        for(size_t s = 0; s < m_count; s++) {
-            if(m_ids[s] == other.m_ids[o]) {
-                exist = true;
-                break;
-            }
-        }
+size_t Archetype::insert_entity(Entity entity) {
+    size_t new_offset = offset_to_entity.size();
+    offset_to_entity.push_back(entity);
+    return new_offset;
+}
 
-        if(!exist) {
-            return false;
-        }
+void Archetype::reserve(size_t count) {
+    size_t total = offset_to_entity.size() + count;
+    offset_to_entity.reserve(total);
+    for(size_t id : compound_indices) {
+        compound[id]->reserve(total);
+        compound[id]->reserve_ticks(total);
     }
+}
 
-    return true;
-}
\ No newline at end of file
+FastSignature Archetype::get_fast_signature() {
+    return fast_signature;
+}
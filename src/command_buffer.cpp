@@ -0,0 +1,307 @@
+#include "command_buffer.h"
+#include "set.h"
+#include <algorithm>
+#include <unordered_map>
+
+using namespace eset;
+
+CommandBuffer::~CommandBuffer() {
+    clear();
+}
+
+Entity CommandBuffer::create() {
+    created_count++;
+    Entity placeholder = make_entity(0, created_count);
+    commands.push_back({CommandType::CREATE, placeholder, {}});
+    return placeholder;
+}
+
+void CommandBuffer::remove(Entity entity) {
+    commands.push_back({CommandType::REMOVE, entity, {}});
+}
+
+void CommandBuffer::clear() {
+    for(Command& command : commands) {
+        if(command.type == CommandType::INSERT) {
+            command.component.destroy(command.component.value);
+        }
+    }
+    commands.clear();
+    created_count = 0;
+}
+
+size_t CommandBuffer::size() {
+    return commands.size();
+}
+
+std::vector<Entity> CommandBuffer::flush(Set& set) {
+
+    //take the commands, so the buffer can be recorded into again from signals
+    std::vector<Command> recorded;
+    recorded.swap(commands);
+    created_count = 0;
+
+    //combine the commands into the final state of every entity they touch
+    std::vector<EntityPlan> plans;
+    std::unordered_map<Entity, size_t> plan_indices;
+    std::vector<size_t> created_plans;
+    for(Command& command : recorded) {
+
+        if(command.type == CommandType::CREATE) {
+            plan_indices[command.entity] = plans.size();
+            created_plans.push_back(plans.size());
+            plans.emplace_back(command.entity);
+            continue;
+        }
+
+        auto it = plan_indices.find(command.entity);
+        if(it == plan_indices.end()) {
+
+            //placeholders that weren't created by this buffer mean nothing
+            if(entity_index(command.entity) == 0) {
+                if(command.type == CommandType::INSERT) {
+                    command.component.destroy(command.component.value);
+                }
+                continue;
+            }
+            it = plan_indices.emplace(command.entity, plans.size()).first;
+            plans.emplace_back(command.entity);
+        }
+
+        //nothing happens to an entity after it's removed
+        EntityPlan& plan = plans[it->second];
+        if(plan.removed) {
+            if(command.type == CommandType::INSERT) {
+                command.component.destroy(command.component.value);
+            }
+            continue;
+        }
+
+        size_t id = command.component.id;
+        auto pending = std::find_if(plan.inserts.begin(), plan.inserts.end(), [id](PendingComponent& component) {
+            return component.id == id;
+        });
+        switch(command.type) {
+            case CommandType::INSERT:
+                //the last insert of a component wins, and undoes an earlier removal
+                if(pending != plan.inserts.end()) {
+                    pending->destroy(pending->value);
+                    *pending = command.component;
+                } else {
+                    plan.inserts.push_back(command.component);
+                }
+                std::erase(plan.removed_ids, id);
+                break;
+            case CommandType::REMOVE_COMPONENT:
+                if(pending != plan.inserts.end()) {
+                    pending->destroy(pending->value);
+                    plan.inserts.erase(pending);
+                }
+                if(std::find(plan.removed_ids.begin(), plan.removed_ids.end(), id) == plan.removed_ids.end()) {
+                    plan.removed_ids.push_back(id);
+                }
+                break;
+            case CommandType::REMOVE:
+                for(PendingComponent& component : plan.inserts) {
+                    component.destroy(component.value);
+                }
+                plan.inserts.clear();
+                plan.removed_ids.clear();
+                plan.removed = true;
+                break;
+            default:
+                break;
+        }
+    }
+
+    //remove first, so there's less left to move around
+    for(EntityPlan& plan : plans) {
+        if(plan.removed && entity_index(plan.entity) != 0) {
+            set.remove(plan.entity);
+        }
+    }
+
+    //tell the remove observers while the components still exist. They can change the
+    //set, so nothing is worked out until they ran, and nothing calls observers after
+    //that until every entity is in its place.
+    for(EntityPlan& plan : plans) {
+        if(plan.removed || entity_index(plan.entity) == 0) {
+            continue;
+        }
+        for(size_t id : plan.removed_ids) {
+            EntitySlot* slot = set.find_slot(plan.entity);
+            if(slot && set.archetypes[slot->archetype_index].fast_signature.contains(id)) {
+                set.emit_on_remove(id, plan.entity);
+            }
+        }
+    }
+
+    //work out where every entity ends up. New entities start out without components.
+    std::vector<size_t> order;
+    for(size_t i = 0; i < plans.size(); i++) {
+        EntityPlan& plan = plans[i];
+        if(plan.removed) {
+            continue;
+        }
+        size_t source_index = 0;
+        if(entity_index(plan.entity) != 0) {
+            EntitySlot* slot = set.find_slot(plan.entity);
+            if(!slot) {
+                for(PendingComponent& component : plan.inserts) {
+                    component.destroy(component.value);
+                }
+                plan.inserts.clear();
+                plan.removed = true;
+                continue;
+            }
+            source_index = slot->archetype_index;
+        }
+        plan.destination = destination_archetype(set, source_index, plan);
+        order.push_back(i);
+    }
+
+    //apply the entities grouped by destination, so every archetype only grows once
+    std::stable_sort(order.begin(), order.end(), [&plans](size_t a, size_t b) {
+        return plans[a].destination < plans[b].destination;
+    });
+    for(size_t begin = 0; begin < order.size();) {
+        size_t destination = plans[order[begin]].destination;
+        size_t end = begin;
+        while(end < order.size() && plans[order[end]].destination == destination) {
+            end++;
+        }
+        set.archetypes[destination].reserve(end - begin);
+        for(size_t i = begin; i < end; i++) {
+            apply(set, plans[order[i]]);
+        }
+        begin = end;
+    }
+
+    //every entity is complete, so the observers can look at all of their new components.
+    //Components an earlier observer already took away again aren't reported.
+    for(EntityPlan& plan : plans) {
+        for(size_t id : plan.inserted_ids) {
+            EntitySlot* slot = set.find_slot(plan.entity);
+            if(slot && set.archetypes[slot->archetype_index].fast_signature.contains(id)) {
+                set.emit_on_insert(id, plan.entity);
+            }
+        }
+    }
+
+    std::vector<Entity> created;
+    created.reserve(created_plans.size());
+    for(size_t i : created_plans) {
+        created.push_back(plans[i].removed ? null : plans[i].entity);
+    }
+
+    //the whole buffer is one batch for the batch observers
+    set.flush_observers();
+    return created;
+}
+
+size_t CommandBuffer::destination_archetype(Set& set, size_t source_index, EntityPlan& plan) {
+
+    Archetype& source = set.archetypes[source_index];
+
+    //only components the entity has can be removed
+    std::erase_if(plan.removed_ids, [&source](size_t id) {
+        return !source.fast_signature.contains(id);
+    });
+
+    bool adds = false;
+    for(PendingComponent& component : plan.inserts) {
+        adds |= !source.fast_signature.contains(component.id);
+    }
+    if(!adds && plan.removed_ids.empty()) {
+        return source_index;
+    }
+
+    //every component and tag the entity keeps, and the ones it gets
+    FastSignature signature;
+    std::vector<size_t> kept;
+    std::vector<size_t> tag_ids;
+    for(size_t id : source.compound_indices) {
+        if(std::find(plan.removed_ids.begin(), plan.removed_ids.end(), id) == plan.removed_ids.end()) {
+            signature.add(id);
+            kept.push_back(id);
+        }
+    }
+    for(size_t id : source.tag_indices) {
+        if(std::find(plan.removed_ids.begin(), plan.removed_ids.end(), id) == plan.removed_ids.end()) {
+            signature.add(id);
+            tag_ids.push_back(id);
+        }
+    }
+    for(PendingComponent& component : plan.inserts) {
+        if(!source.fast_signature.contains(component.id)) {
+            signature.add(component.id);
+        }
+    }
+
+    size_t destination_index = set.find_archetype(signature);
+    if(destination_index == -1) {
+        std::vector<BaseStorage*> storage_pointers;
+        for(size_t id : kept) {
+            storage_pointers.push_back(source.compound[id]->make_empty_copy());
+        }
+        for(PendingComponent& component : plan.inserts) {
+            if(source.fast_signature.contains(component.id)) {
+                continue;
+            }
+            if(Types::info(component.id).tag) {
+                tag_ids.push_back(component.id);
+            } else {
+                storage_pointers.push_back(Types::info(component.id).make_storage());
+            }
+        }
+        destination_index = set.create_archetype(storage_pointers, tag_ids);
+    }
+    return destination_index;
+}
+
+void CommandBuffer::apply(Set& set, EntityPlan& plan) {
+
+    Archetype& destination = set.archetypes[plan.destination];
+    FastSignature had;
+
+    if(entity_index(plan.entity) == 0) {
+
+        //a new entity goes straight into its destination
+        plan.entity = set.allocate_entity(plan.destination, destination.count());
+        destination.insert_entity(plan.entity);
+        for(PendingComponent& component : plan.inserts) {
+            if(!Types::info(component.id).tag) {
+                set.insert_new(destination.compound[component.id], component.value);
+            }
+        }
+    } else {
+
+        //overwrite the components the entity already has before it moves, so they move along
+        EntitySlot* slot = set.find_slot(plan.entity);
+        Archetype& source = set.archetypes[slot->archetype_index];
+        had = source.fast_signature;
+        for(PendingComponent& component : plan.inserts) {
+            if(had.contains(component.id) && !Types::info(component.id).tag) {
+                set.insert_existing(source.compound[component.id], slot->offset, component.value);
+            }
+        }
+
+        if(slot->archetype_index != plan.destination) {
+            set.move_entity(plan.entity, plan.destination);
+        }
+        for(PendingComponent& component : plan.inserts) {
+            if(!had.contains(component.id) && !Types::info(component.id).tag) {
+                set.insert_new(destination.compound[component.id], component.value);
+            }
+        }
+    }
+
+    //the values have been moved out of, but still need to be destroyed
+    for(PendingComponent& component : plan.inserts) {
+        if(!had.contains(component.id)) {
+            plan.inserted_ids.push_back(component.id);
+        }
+        component.destroy(component.value);
+    }
+    plan.inserts.clear();
+}
@@ -1,13 +1,144 @@
 #include "component_storage.h"
+#include "reference.h"
+#include <algorithm>
 
 using namespace eset;
 
-uint16_t BaseStorage::m_storage_count = 0;
+void BaseStorage::push_ticks(uint32_t added_tick, uint32_t changed_tick, size_t count) {
+    m_added_ticks.insert(m_added_ticks.end(), count, added_tick);
+    m_changed_ticks.insert(m_changed_ticks.end(), count, changed_tick);
+    m_last_added_tick = std::max(m_last_added_tick, added_tick);
+    m_last_changed_tick = std::max(m_last_changed_tick, changed_tick);
+    if(!m_references.empty()) {
+        m_references.insert(m_references.end(), count, nullptr);
+    }
+}
+
+void BaseStorage::reserve_ticks(size_t count) {
+    m_added_ticks.reserve(count);
+    m_changed_ticks.reserve(count);
+}
+
+void BaseStorage::remove_ticks(uint64_t offset) {
+    m_added_ticks[offset] = m_added_ticks.back();
+    m_changed_ticks[offset] = m_changed_ticks.back();
+    m_added_ticks.pop_back();
+    m_changed_ticks.pop_back();
+
+    //the referenced component at the end moves along to the offset
+    if(!m_references.empty()) {
+        ReferenceData* reference_data = m_references.back();
+        m_references[offset] = reference_data;
+        m_references.pop_back();
+        if(reference_data) {
+            reference_data->m_offset = offset;
+        }
+        release_references();
+    }
+}
+
+void BaseStorage::push_ticks_from(BaseStorage* source, uint64_t offset, size_t count) {
+    m_added_ticks.insert(m_added_ticks.end(), source->m_added_ticks.begin() + offset, source->m_added_ticks.begin() + offset + count);
+    m_changed_ticks.insert(m_changed_ticks.end(), source->m_changed_ticks.begin() + offset, source->m_changed_ticks.begin() + offset + count);
+
+    //the latest ticks of the source are at least as late as the copied ones
+    m_last_added_tick = std::max(m_last_added_tick, source->m_last_added_tick);
+    m_last_changed_tick = std::max(m_last_changed_tick, source->m_last_changed_tick);
+    if(!m_references.empty()) {
+        m_references.insert(m_references.end(), count, nullptr);
+    }
+}
+
+void BaseStorage::push_ticks(const uint32_t* added_ticks, const uint32_t* changed_ticks, size_t count) {
+    m_added_ticks.insert(m_added_ticks.end(), added_ticks, added_ticks + count);
+    m_changed_ticks.insert(m_changed_ticks.end(), changed_ticks, changed_ticks + count);
+    for(size_t i = 0; i < count; i++) {
+        m_last_added_tick = std::max(m_last_added_tick, added_ticks[i]);
+        m_last_changed_tick = std::max(m_last_changed_tick, changed_ticks[i]);
+    }
+    if(!m_references.empty()) {
+        m_references.insert(m_references.end(), count, nullptr);
+    }
+}
+
+size_t BaseStorage::bookkeeping_bytes() {
+    return (m_added_ticks.size() + m_changed_ticks.size()) * sizeof(uint32_t) + m_references.size() * sizeof(ReferenceData*);
+}
+
+size_t BaseStorage::bookkeeping_capacity_bytes() {
+    return (m_added_ticks.capacity() + m_changed_ticks.capacity()) * sizeof(uint32_t) + m_references.capacity() * sizeof(ReferenceData*);
+}
+
+void BaseStorage::move_ticks(uint64_t destination, uint64_t source, size_t count) {
+    std::copy(m_added_ticks.begin() + source, m_added_ticks.begin() + source + count, m_added_ticks.begin() + destination);
+    std::copy(m_changed_ticks.begin() + source, m_changed_ticks.begin() + source + count, m_changed_ticks.begin() + destination);
+    if(has_references()) {
+        for(size_t i = 0; i < count; i++) {
+            ReferenceData* reference_data = m_references[source + i];
+            m_references[destination + i] = reference_data;
+            m_references[source + i] = nullptr;
+            if(reference_data) {
+                reference_data->m_offset = destination + i;
+            }
+        }
+    }
+}
+
+void BaseStorage::truncate_ticks(size_t count) {
+    m_added_ticks.resize(count);
+    m_changed_ticks.resize(count);
+    if(!m_references.empty()) {
+        m_references.resize(count);
+        release_references();
+    }
+}
+
+void BaseStorage::set_changed_tick(uint64_t offset, uint32_t tick) {
+    m_changed_ticks[offset] = tick;
+    m_last_changed_tick = std::max(m_last_changed_tick, tick);
+}
+
+uint32_t BaseStorage::added_tick(uint64_t offset) {
+    return m_added_ticks[offset];
+}
+
+uint32_t BaseStorage::changed_tick(uint64_t offset) {
+    return m_changed_ticks[offset];
+}
+
+const uint32_t* BaseStorage::added_ticks() {
+    return m_added_ticks.data();
+}
 
-uint16_t BaseStorage::storage_id() {
-    return m_storage_id;
+const uint32_t* BaseStorage::changed_ticks() {
+    return m_changed_ticks.data();
 }
 
-uint64_t BaseStorage::storage_offset_identifier(uint64_t offset) {
-    return ((uint64_t)storage_id() << 48) | offset;
-}
\ No newline at end of file
+uint32_t BaseStorage::last_added_tick() {
+    return m_last_added_tick;
+}
+
+uint32_t BaseStorage::last_changed_tick() {
+    return m_last_changed_tick;
+}
+
+void BaseStorage::set_reference(uint64_t offset, ReferenceData* reference_data) {
+
+    if(m_references.empty()) {
+        if(!reference_data) {
+            return;
+        }
+        m_references.resize(m_added_ticks.size(), nullptr);
+    }
+
+    //the references stay when the last one is cleared, so taking and dropping
+    //a reference again doesn't cost a pass over the whole storage
+    m_referenced_count += (reference_data != nullptr) - (m_references[offset] != nullptr);
+    m_references[offset] = reference_data;
+}
+
+void BaseStorage::release_references() {
+    if(m_references.empty()) {
+        std::vector<ReferenceData*>().swap(m_references);
+    }
+}
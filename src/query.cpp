@@ -0,0 +1,32 @@
+#include "query.h"
+#include "set.h"
+
+using namespace eset;
+
+BaseQuery::BaseQuery(Set& set, FastSignature signature, FastSignature excluded) {
+    m_set = &set;
+    m_signature = signature;
+    m_excluded = excluded;
+    set.register_query(this);
+}
+
+BaseQuery::~BaseQuery() {
+    if(m_set) {
+        m_set->unregister_query(this);
+    }
+}
+
+Set* BaseQuery::set() {
+    return m_set;
+}
+
+size_t BaseQuery::archetype_count() {
+    return m_archetypes.size();
+}
+
+void BaseQuery::add_archetype(Archetype* archetype) {
+    FastSignature archetype_signature = archetype->get_fast_signature();
+    if(archetype_signature.contains(m_signature) && !archetype_signature.intersects(m_excluded)) {
+        m_archetypes.push_back(archetype);
+    }
+}
@@ -24,6 +24,16 @@ bool BaseReference::valid() {
     }
 }
 
-void BaseReference::let_set_delete_reference_data() {
-    m_reference_data->m_set->delete_reference_pointer(m_reference_data);
+void BaseReference::release_reference_data() {
+    if(m_reference_data->m_set) {
+        m_reference_data->m_set->release_reference_data(m_reference_data);
+    } else {
+
+        //the set is gone and left the block to its references
+        ReferenceBlock* block = m_reference_data->m_block;
+        block->used--;
+        if(block->used == 0) {
+            delete block;
+        }
+    }
 }
\ No newline at end of file
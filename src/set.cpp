@@ -1,27 +1,75 @@
 #include "set.h"
+#include <algorithm>
 
 using namespace eset;
 
 Set::Set() {
 
     //create an empty archetype, so we can assign newly created entities to it
-    archetypes.emplace_back();
+    std::vector<BaseStorage*> no_storages;
+    create_archetype(no_storages);
+
+    //the first slot belongs to the null entity, which never exists
+    entity_slots.emplace_back();
 } 
 
 Set::~Set() {
 
-    //remove all set pointers from references
-    for(ReferenceData* reference_data : reference_datas) {
-        reference_data->m_set = nullptr;
+    //the references that are still alive keep their blocks, but lose their set and
+    //their components. Only the data of live references still points at the set.
+    for(ReferenceBlock* block : reference_blocks) {
+        if(block->used == 0) {
+            delete block;
+            continue;
+        }
+        for(ReferenceData& reference_data : block->datas) {
+            if(reference_data.m_set) {
+                reference_data.m_set = nullptr;
+                reference_data.m_storage = nullptr;
+            }
+        }
+    }
+
+    //and from the queries, which are left without archetypes
+    for(BaseQuery* query : queries) {
+        query->m_set = nullptr;
+        query->m_archetypes.clear();
+    }
+
+    for(ResourceSlot& slot : resources) {
+        if(slot.value) {
+            slot.destroy(slot.value);
+        }
     }
 }
 
 bool Set::remove(Entity entity) {
-    auto archetype_index_it = entities.find(entity);
-    if(archetype_index_it != entities.end()) {
-        size_t archetype_index = archetype_index_it->second;
-        archetypes[archetype_index].remove_entity(entity, this);
-        entities.erase(entity);
+    EntitySlot* slot = find_slot(entity);
+    if(slot) {
+
+        //let the observers know before anything is removed, so they can still read every
+        //component. Archetypes without observed components skip this with a single check
+        Archetype& archetype = archetypes[slot->archetype_index];
+        if(observed.intersects(archetype.fast_signature)) {
+            for(size_t id : archetype.compound_indices) {
+                emit_on_remove(id, entity);
+            }
+            for(size_t id : archetype.tag_indices) {
+                emit_on_remove(id, entity);
+            }
+
+            //the observers could have changed the set, and even removed the entity
+            slot = find_slot(entity);
+            if(!slot) {
+                return true;
+            }
+        }
+        remove_from_archetype(slot->archetype_index, slot->offset);
+
+        //bump the generation so old handles to this index become stale, then reuse it later
+        slot->archetype_index = -1;
+        slot->generation++;
+        free_indices.push_back(entity_index(entity));
         return true;
     } else {
         return false;
@@ -29,94 +77,335 @@ bool Set::remove(Entity entity) {
 }
 
 bool Set::exist(Entity entity) {
-    return entities.find(entity) != entities.end();
+    return find_slot(entity) != nullptr;
 }
 
 Entity Set::create() {
-    size_t new_id = entity_counter;
-    entity_counter++;
-    entities.emplace(new_id, 0); //assign the default archetype
-    archetypes[0].insert_entity(new_id);
-    return new_id;
+    Entity entity = allocate_entity(0, archetypes[0].count()); //assign the default archetype
+    archetypes[0].insert_entity(entity);
+    return entity;
+}
+
+uint32_t Set::current_tick() {
+    return change_tick;
 }
 
-size_t Set::find_archetype(ArchetypeSignature& signature) {
+uint32_t Set::advance_tick() {
+    return change_tick++;
+}
+
+SetStats Set::stats() {
+
+    SetStats stats;
+    stats.archetype_count = archetypes.size();
+    stats.archetypes.reserve(archetypes.size());
+    stats.migrations = migrations;
+    stats.swap_removes = swap_removes;
+    stats.find_archetype_misses = find_archetype_misses;
 
     for(size_t i = 0; i < archetypes.size(); i++) {
-        if(archetypes[i].get_archetype_signature() == signature) {
-            return i;
+        Archetype& archetype = archetypes[i];
+        ArchetypeStats archetype_stats;
+        archetype_stats.index = i;
+        archetype_stats.entities = archetype.count();
+        archetype_stats.first_column = stats.columns.size();
+        archetype_stats.column_count = archetype.compound_indices.size();
+        archetype_stats.bytes = archetype.offset_to_entity.capacity() * sizeof(Entity);
+        archetype_stats.slack_bytes = (archetype.offset_to_entity.capacity() - archetype.count()) * sizeof(Entity);
+
+        for(size_t id : archetype.compound_indices) {
+            BaseStorage* storage = archetype.compound[id];
+            ColumnStats column;
+            column.component_id = id;
+            column.name = Types::info(id).name;
+            column.component_size = storage->get_component_size();
+            column.count = storage->get_component_count();
+            column.capacity = storage->capacity();
+            column.bytes = column.capacity * column.component_size + storage->bookkeeping_capacity_bytes();
+            column.slack_bytes = column.bytes - column.count * column.component_size - storage->bookkeeping_bytes();
+            archetype_stats.bytes += column.bytes;
+            archetype_stats.slack_bytes += column.slack_bytes;
+            stats.columns.push_back(column);
         }
+
+        stats.empty_archetype_count += archetype.count() == 0;
+        stats.entity_count += archetype.count();
+        stats.bytes += archetype_stats.bytes;
+        stats.slack_bytes += archetype_stats.slack_bytes;
+        stats.archetypes.push_back(archetype_stats);
     }
 
-    return -1;
+    //the entity slots and the indices waiting to be reused
+    stats.bytes += entity_slots.capacity() * sizeof(EntitySlot) + free_indices.capacity() * sizeof(size_t);
+    stats.slack_bytes += (entity_slots.capacity() - entity_slots.size()) * sizeof(EntitySlot) + (free_indices.capacity() - free_indices.size()) * sizeof(size_t);
+
+    for(ReferenceBlock* block : reference_blocks) {
+        stats.live_references += block->used;
+        stats.bytes += sizeof(ReferenceBlock);
+    }
+    stats.slack_bytes += free_reference_datas.size() * sizeof(ReferenceData);
+    return stats;
 }
 
-ReferenceData* Set::reference_data(BaseStorage* storage, size_t offset) {
-    uint64_t sid = storage->storage_offset_identifier(offset);
-    auto it = sid_to_reference_data.find(sid);
-    if(it != sid_to_reference_data.end()) {
-        return it->second;
+void Set::reset_counters() {
+    migrations = 0;
+    swap_removes = 0;
+    find_archetype_misses = 0;
+}
+
+void Set::flush_observers() {
+    for(size_t id = 0; id < observers.size(); id++) {
+        Observers& component_observers = observers[id];
+
+        //take the batches first, so the observers can add to the next ones
+        if(!component_observers.inserted.empty()) {
+            std::vector<Entity> inserted;
+            inserted.swap(component_observers.inserted);
+            component_observers.on_insert_batch.emit(inserted);
+        }
+        if(!component_observers.removed.empty()) {
+            std::vector<Entity> removed;
+            removed.swap(component_observers.removed);
+            component_observers.on_remove_batch.emit(removed);
+        }
+    }
+}
+
+void Set::set_worker_count(size_t worker_count) {
+    this->worker_count = worker_count;
+    workers.reset();
+}
+
+ThreadPool& Set::thread_pool() {
+    if(!workers) {
+        workers = std::make_unique<ThreadPool>(worker_count);
+    }
+    return *workers;
+}
+
+std::vector<RowRange> Set::split_rows(const std::vector<Archetype*>& matching) {
+
+    size_t total = 0;
+    for(Archetype* archetype : matching) {
+        total += archetype->count();
+    }
+
+    //aim for a few jobs per worker, so the ones that finish early can steal
+    size_t rows_per_job = std::max(min_rows_per_job, total / (thread_pool().worker_count() * 4) + 1);
+    std::vector<RowRange> ranges;
+    for(Archetype* archetype : matching) {
+        for(size_t begin = 0; begin < archetype->count(); begin += rows_per_job) {
+            ranges.push_back({archetype, begin, std::min(begin + rows_per_job, archetype->count())});
+        }
+    }
+    return ranges;
+}
+
+Entity Set::allocate_entity(size_t archetype_index, size_t offset) {
+
+    //reuse a removed index if there is one
+    size_t index;
+    if(!free_indices.empty()) {
+        index = free_indices.back();
+        free_indices.pop_back();
     } else {
-        //it doesn't exist, so create a new one
-        ReferenceData* new_reference_data = new ReferenceData();
-        new_reference_data->m_reference_count = 0;
-        new_reference_data->m_storage = storage;
-        new_reference_data->m_offset = offset;
-        new_reference_data->m_set = this;
+        index = entity_slots.size();
+        entity_slots.emplace_back();
+    }
+
+    EntitySlot& slot = entity_slots[index];
+    slot.archetype_index = archetype_index;
+    slot.offset = offset;
+    return make_entity(index, slot.generation);
+}
 
-        //insert it and return
-        sid_to_reference_data.emplace(sid, new_reference_data);
-        reference_datas.emplace(new_reference_data);
-        return new_reference_data;
+size_t Set::find_archetype(FastSignature& signature) {
+
+    auto bucket = signature_to_archetypes.find(signature.hash());
+    if(bucket != signature_to_archetypes.end()) {
+        for(size_t i : bucket->second) {
+            if(archetypes[i].fast_signature == signature) {
+                return i;
+            }
+        }
     }
+
+    find_archetype_misses++;
+    return -1;
 }
 
-void Set::swap_reference_data(BaseStorage* old_storage, uint64_t old_offset, BaseStorage* new_storage, uint64_t new_offset) {
+size_t Set::create_archetype(std::vector<BaseStorage*>& storage_pointers, const std::vector<size_t>& tag_ids) {
+    size_t index = archetypes.size();
+    archetypes.emplace_back(storage_pointers, tag_ids);
+    signature_to_archetypes[archetypes[index].fast_signature.hash()].push_back(index);
 
-    uint64_t old_sid = old_storage->storage_offset_identifier(old_offset);
-    uint64_t new_sid = new_storage->storage_offset_identifier(new_offset);
-    auto srd = sid_to_reference_data.find(old_sid);
-    if(srd != sid_to_reference_data.end()) {
-        ReferenceData* reference_data = srd->second;
-        reference_data->m_storage = new_storage;
-        reference_data->m_offset = new_offset;
-        sid_to_reference_data.erase(old_sid);
-        sid_to_reference_data.emplace(new_sid, reference_data);
+    //let the queries know, so they never have to search for archetypes themselves
+    for(BaseQuery* query : queries) {
+        query->add_archetype(&archetypes[index]);
+    }
+    return index;
+}
+
+BaseQuery& Set::cached_query(FastSignature signature, FastSignature excluded) {
+    std::pair<FastSignature, FastSignature> key(signature, excluded);
+    auto it = cached_queries.find(key);
+    if(it == cached_queries.end()) {
+        it = cached_queries.emplace(key, std::make_unique<BaseQuery>(*this, signature, excluded)).first;
+    }
+    return *it->second;
+}
 
-        
+void Set::register_query(BaseQuery* query) {
+    queries.push_back(query);
+    for(Archetype& archetype : archetypes) {
+        query->add_archetype(&archetype);
     }
 }
 
-void Set::delete_reference_pointer(ReferenceData* reference_data) {
-    if(reference_datas.find(reference_data) != reference_datas.end()) {
-        BaseStorage* storage = reference_data->m_storage;
-        uint64_t offset = reference_data->m_offset;
-        delete reference_data;
+void Set::unregister_query(BaseQuery* query) {
+    queries.erase(std::find(queries.begin(), queries.end(), query));
+}
+
+void Set::move_entity(Entity entity, size_t to_index) {
 
-        //remove from set
-        if(storage) {
-            sid_to_reference_data.erase(storage->storage_offset_identifier(offset));
+    EntitySlot& slot = entity_slots[entity_index(entity)];
+    size_t from_index = slot.archetype_index;
+    size_t old_offset = slot.offset;
+    Archetype& from = archetypes[from_index];
+    Archetype& to = archetypes[to_index];
+    size_t new_offset = to.insert_entity(entity);
+
+    for(size_t id : from.compound_indices) {
+        if(to.fast_signature.contains(id)) {
+            BaseStorage* storage = from.compound[id];
+            to.compound[id]->push_back_range(storage, old_offset, 1);
+            to.compound[id]->push_ticks_from(storage, old_offset, 1);
+
+            //move the reference along, so it doesn't become invalid when the old row is removed
+            ReferenceData* reference_data = storage->reference(old_offset);
+            if(reference_data) {
+                storage->set_reference(old_offset, nullptr);
+                to.compound[id]->set_reference(new_offset, reference_data);
+                reference_data->m_storage = to.compound[id];
+                reference_data->m_offset = new_offset;
+            }
         }
-        if(reference_data) {
-            reference_datas.erase(reference_data);
+    }
+
+    //remove from old archetype
+    migrations++;
+    remove_from_archetype(from_index, old_offset);
+    slot.archetype_index = to_index;
+    slot.offset = new_offset;
+}
+
+void Set::move_rows(size_t from_index, const std::vector<size_t>& offsets, size_t to_index) {
+
+    Archetype& from = archetypes[from_index];
+    Archetype& to = archetypes[to_index];
+    to.reserve(offsets.size());
+
+    for(size_t i = 0; i < offsets.size();) {
+
+        //find a run of consecutive rows
+        size_t begin = offsets[i];
+        size_t count = 1;
+        while(i + count < offsets.size() && offsets[i + count] == begin + count) {
+            count++;
+        }
+        i += count;
+
+        size_t new_offset = to.count();
+        for(size_t id : from.compound_indices) {
+            if(to.fast_signature.contains(id)) {
+                BaseStorage* storage = from.compound[id];
+                to.compound[id]->push_back_range(storage, begin, count);
+                to.compound[id]->push_ticks_from(storage, begin, count);
+
+                //move the references along, so they don't become invalid when the old rows are removed
+                if(storage->has_references()) {
+                    for(size_t row = 0; row < count; row++) {
+                        ReferenceData* reference_data = storage->reference(begin + row);
+                        if(reference_data) {
+                            storage->set_reference(begin + row, nullptr);
+                            to.compound[id]->set_reference(new_offset + row, reference_data);
+                            reference_data->m_storage = to.compound[id];
+                            reference_data->m_offset = new_offset + row;
+                        }
+                    }
+                }
+            }
+        }
+
+        for(size_t row = 0; row < count; row++) {
+            Entity entity = from.offset_to_entity[begin + row];
+            to.offset_to_entity.push_back(entity);
+            EntitySlot& slot = entity_slots[entity_index(entity)];
+            slot.archetype_index = to_index;
+            slot.offset = new_offset + row;
         }
     }
+
+    migrations += offsets.size();
+    swap_removes += from.remove_rows(offsets, this);
 }
 
-void Set::make_reference_data_pointer_null(BaseStorage* storage, uint64_t offset) {
-    uint64_t sid = storage->storage_offset_identifier(offset);
-    auto it = sid_to_reference_data.find(sid);
-    if(it != sid_to_reference_data.end()) {
-        it->second->m_storage = nullptr;
-        it->second->m_offset = 0;
-        sid_to_reference_data.erase(sid);
+void Set::remove_from_archetype(size_t archetype_index, size_t offset) {
+    Entity moved_entity = archetypes[archetype_index].remove_entity(offset);
+    if(moved_entity != null) {
+        entity_slots[entity_index(moved_entity)].offset = offset;
+        swap_removes++;
+    }
+}
+
+void Set::emit_on_insert(size_t id, std::span<const Entity> entities) {
+    if(!observed.contains(id) || entities.empty()) {
+        return;
+    }
+    Observers& component_observers = observers[id];
+    for(Entity entity : entities) {
+        component_observers.on_insert.emit(entity);
     }
+    if(!component_observers.on_insert_batch.empty()) {
+        component_observers.inserted.insert(component_observers.inserted.end(), entities.begin(), entities.end());
+    }
+}
+
+ReferenceData* Set::reference_data(BaseStorage* storage, size_t offset) {
+
+    ReferenceData* reference_data = storage->reference(offset);
+    if(reference_data) {
+        return reference_data;
+    }
+
+    //it doesn't exist, so take a new one from the pool
+    if(free_reference_datas.empty()) {
+        ReferenceBlock* block = new ReferenceBlock();
+        reference_blocks.push_back(block);
+        for(size_t i = ReferenceBlock::size; i > 0; i--) {
+            block->datas[i - 1].m_set = nullptr;
+            block->datas[i - 1].m_block = block;
+            free_reference_datas.push_back(&block->datas[i - 1]);
+        }
+    }
+    reference_data = free_reference_datas.back();
+    free_reference_datas.pop_back();
+    reference_data->m_block->used++;
+
+    reference_data->m_reference_count = 0;
+    reference_data->m_storage = storage;
+    reference_data->m_offset = offset;
+    reference_data->m_set = this;
+    storage->set_reference(offset, reference_data);
+    return reference_data;
 }
 
-void Set::make_reference_entity_null(BaseStorage* storage, uint64_t offset) {
-    uint64_t sid = storage->storage_offset_identifier(offset);
-    auto it = sid_to_reference_data.find(sid);
-    if(it != sid_to_reference_data.end()) {
-        it->second->m_entity = 0;
+void Set::release_reference_data(ReferenceData* reference_data) {
+    if(reference_data->m_storage) {
+        reference_data->m_storage->set_reference(reference_data->m_offset, nullptr);
     }
+    reference_data->m_storage = nullptr;
+    reference_data->m_set = nullptr;
+    reference_data->m_block->used--;
+    free_reference_datas.push_back(reference_data);
 }
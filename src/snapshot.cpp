@@ -0,0 +1,459 @@
+#include "set.h"
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <streambuf>
+
+#if defined(_WIN32)
+#include <new>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace eset;
+
+/*
+    The layout of a saved set, in the byte order of the machine that saved it.
+    Every field is 8 byte aligned, and raw columns start at a multiple of 64
+    bytes, so a mapped file can be read without unaligned loads.
+
+    header:     "ESET", version, byte order mark, change tick,
+                slot count, free index count, archetype count
+    slots:      the generation of every entity index
+    free:       the indices waiting to be reused, in order
+    archetypes: entity count, column count, tag count, the entities,
+                the type hashes of the tags, then per column:
+                type hash, component size, serialized flag, byte count,
+                added ticks, changed ticks and the component bytes.
+                Raw columns are the components as they are in memory,
+                serialized ones whatever the serializer of the type wrote.
+*/
+namespace {
+
+    const char magic[4] = {'E', 'S', 'E', 'T'};
+    const uint32_t version = 2;
+    const uint32_t byte_order = 0x01020304;
+    const size_t column_alignment = 64;
+
+    class Writer {
+        public:
+
+            Writer(const std::string& path) : out(path, std::ios::binary | std::ios::trunc) {}
+
+            template<typename T>
+            void write(const T& value) {
+                write(&value, sizeof(T));
+            }
+
+            void write(const void* data, size_t bytes) {
+                out.write((const char*)data, bytes);
+                position += bytes;
+            }
+
+            void pad(size_t alignment) {
+                static const char zeros[column_alignment] = {};
+                if(position % alignment != 0) {
+                    write(zeros, alignment - position % alignment);
+                }
+            }
+
+            bool good() {
+                return out.good();
+            }
+
+        private:
+            std::ofstream out;
+            size_t position = 0;
+    };
+
+    //walks a file in memory, failing instead of reading past its end
+    class Reader {
+        public:
+
+            Reader(const char* data, size_t size) : begin(data), position(data), end(data + size) {}
+
+            const char* take(size_t bytes) {
+                if(failed || (size_t)(end - position) < bytes) {
+                    failed = true;
+                    return nullptr;
+                }
+                const char* data = position;
+                position += bytes;
+                return data;
+            }
+
+            template<typename T>
+            T read() {
+                T value{};
+                const char* data = take(sizeof(T));
+                if(data) {
+                    memcpy(&value, data, sizeof(T));
+                }
+                return value;
+            }
+
+            //returns count values of T, or nullptr if the file is too short
+            template<typename T>
+            const T* read_array(size_t count) {
+                if(count > (size_t)(end - position) / sizeof(T)) {
+                    failed = true;
+                    return nullptr;
+                }
+                return (const T*)take(count * sizeof(T));
+            }
+
+            void align(size_t alignment) {
+                size_t offset = (position - begin) % alignment;
+                if(offset != 0) {
+                    take(alignment - offset);
+                }
+            }
+
+            bool failed = false;
+
+        private:
+            const char* begin;
+            const char* position;
+            const char* end;
+    };
+
+    //a whole file in memory. Mapped where possible, so the page cache is read directly
+    class FileView {
+        public:
+
+            FileView(const std::string& path) {
+            #if defined(_WIN32)
+                std::ifstream in(path, std::ios::binary | std::ios::ate);
+                if(!in) {
+                    return;
+                }
+                size = (size_t)in.tellg();
+                in.seekg(0);
+                buffer = (char*)::operator new(size + 1, std::align_val_t(column_alignment));
+                if(!in.read(buffer, size)) {
+                    size = 0;
+                }
+                data = buffer;
+            #else
+                int file = open(path.c_str(), O_RDONLY);
+                if(file < 0) {
+                    return;
+                }
+                struct stat status;
+                if(fstat(file, &status) == 0 && status.st_size > 0) {
+                    void* mapped = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+                    if(mapped != MAP_FAILED) {
+                        madvise(mapped, status.st_size, MADV_SEQUENTIAL);
+                        data = (const char*)mapped;
+                        size = status.st_size;
+                    }
+                }
+                close(file);
+            #endif
+            }
+
+            ~FileView() {
+            #if defined(_WIN32)
+                ::operator delete(buffer, std::align_val_t(column_alignment));
+            #else
+                if(data) {
+                    munmap((void*)data, size);
+                }
+            #endif
+            }
+
+            FileView(const FileView&) = delete;
+            FileView& operator=(const FileView&) = delete;
+
+            const char* data = nullptr;
+            size_t size = 0;
+
+        private:
+        #if defined(_WIN32)
+            char* buffer = nullptr;
+        #endif
+    };
+
+    //lets a serializer read a column straight from the file
+    class MemoryBuffer : public std::streambuf {
+        public:
+            MemoryBuffer(const char* data, size_t size) {
+                setg((char*)data, (char*)data, (char*)data + size);
+            }
+    };
+
+    //an archetype read from a file, with its columns already filled
+    struct LoadedArchetype {
+        FastSignature signature;
+        std::vector<BaseStorage*> storages;
+        std::vector<size_t> tag_ids;
+        const Entity* entities;
+        size_t count;
+    };
+
+    void delete_storages(std::vector<LoadedArchetype>& loaded) {
+        for(LoadedArchetype& archetype : loaded) {
+            for(BaseStorage* storage : archetype.storages) {
+                delete storage;
+            }
+        }
+    }
+}
+
+bool Set::save(const std::string& path) {
+
+    //every saved column needs to be either raw bytes or have a serializer,
+    //and every saved type needs a hash that only belongs to it
+    for(Archetype& archetype : archetypes) {
+        if(archetype.count() == 0) {
+            continue;
+        }
+        for(size_t id : archetype.compound_indices) {
+            const ComponentInfo& info = Types::info(id);
+            if((!info.trivially_copyable && !info.save) || Types::id_of_hash(info.hash) != id) {
+                return false;
+            }
+        }
+        for(size_t id : archetype.tag_indices) {
+            if(Types::id_of_hash(Types::info(id).hash) != id) {
+                return false;
+            }
+        }
+    }
+
+    Writer out(path);
+    out.write(magic, sizeof(magic));
+    out.write(version);
+    out.write(byte_order);
+    out.write(change_tick);
+
+    size_t saved_archetypes = 0;
+    for(Archetype& archetype : archetypes) {
+        saved_archetypes += archetype.count() != 0;
+    }
+    out.write((uint64_t)entity_slots.size());
+    out.write((uint64_t)free_indices.size());
+    out.write((uint64_t)saved_archetypes);
+
+    for(EntitySlot& slot : entity_slots) {
+        out.write(slot.generation);
+    }
+    out.pad(8);
+    for(size_t index : free_indices) {
+        out.write((uint64_t)index);
+    }
+
+    for(Archetype& archetype : archetypes) {
+        size_t count = archetype.count();
+        if(count == 0) {
+            continue;
+        }
+        out.write((uint64_t)count);
+        out.write((uint64_t)archetype.compound_indices.size());
+        out.write((uint64_t)archetype.tag_indices.size());
+        out.write(archetype.offset_to_entity.data(), count * sizeof(Entity));
+        for(size_t id : archetype.tag_indices) {
+            out.write(Types::info(id).hash);
+        }
+
+        for(size_t id : archetype.compound_indices) {
+            const ComponentInfo& info = Types::info(id);
+            BaseStorage* storage = archetype.compound[id];
+
+            //serialize first, since the byte count comes before the bytes
+            std::string serialized;
+            if(!info.trivially_copyable) {
+                std::ostringstream stream(std::ios::binary);
+                for(size_t offset = 0; offset < count; offset++) {
+                    info.save(storage->get_component_pointer(offset), stream);
+                }
+                serialized = stream.str();
+            }
+
+            out.write(info.hash);
+            out.write((uint64_t)info.size);
+            out.write((uint64_t)!info.trivially_copyable);
+            out.write((uint64_t)(info.trivially_copyable ? count * info.size : serialized.size()));
+            out.write(storage->added_ticks(), count * sizeof(uint32_t));
+            out.write(storage->changed_ticks(), count * sizeof(uint32_t));
+
+            if(info.trivially_copyable) {
+                out.pad(column_alignment);
+                for(size_t offset = 0; offset < count;) {
+                    size_t run = storage->contiguous_count(offset);
+                    out.write(storage->get_component_pointer(offset), run * info.size);
+                    offset += run;
+                }
+            } else {
+                out.write(serialized.data(), serialized.size());
+            }
+            out.pad(8);
+        }
+    }
+    return out.good();
+}
+
+bool Set::load(const std::string& path) {
+
+    //the file brings its own entity indices, so none can be in use
+    if(entity_slots.size() != 1 || !free_indices.empty()) {
+        return false;
+    }
+
+    FileView file(path);
+    if(!file.data) {
+        return false;
+    }
+    Reader in(file.data, file.size);
+
+    const char* file_magic = in.take(sizeof(magic));
+    if(!file_magic || memcmp(file_magic, magic, sizeof(magic)) != 0 || in.read<uint32_t>() != version || in.read<uint32_t>() != byte_order) {
+        return false;
+    }
+    uint32_t file_change_tick = in.read<uint32_t>();
+    uint64_t slot_count = in.read<uint64_t>();
+    uint64_t free_count = in.read<uint64_t>();
+    uint64_t archetype_count = in.read<uint64_t>();
+
+    const uint32_t* generations = in.read_array<uint32_t>(slot_count);
+    in.align(8);
+    const uint64_t* free = in.read_array<uint64_t>(free_count);
+    if(in.failed || slot_count == 0 || slot_count > 0xFFFFFFFF) {
+        return false;
+    }
+
+    //read everything into new storages first, so a bad file leaves the set untouched
+    std::vector<LoadedArchetype> loaded;
+    std::vector<uint8_t> used(slot_count, 0);
+    used[0] = 1;
+    bool valid = true;
+    for(uint64_t a = 0; a < archetype_count && valid; a++) {
+        LoadedArchetype& archetype = loaded.emplace_back();
+        archetype.count = in.read<uint64_t>();
+        uint64_t column_count = in.read<uint64_t>();
+        uint64_t tag_count = in.read<uint64_t>();
+        archetype.entities = in.read_array<Entity>(archetype.count);
+        const uint64_t* tag_hashes = in.read_array<uint64_t>(tag_count);
+        if(in.failed || column_count > MAX_COMPONENTS) {
+            valid = false;
+            break;
+        }
+
+        for(uint64_t t = 0; t < tag_count && valid; t++) {
+            size_t id = Types::id_of_hash(tag_hashes[t]);
+            valid = id != (size_t)-1 && Types::info(id).tag && !archetype.signature.contains(id);
+            if(valid) {
+                archetype.signature.add(id);
+                archetype.tag_ids.push_back(id);
+            }
+        }
+
+        //every entity must be alive in exactly one place, with the generation of its slot
+        for(size_t i = 0; i < archetype.count && valid; i++) {
+            Entity entity = archetype.entities[i];
+            size_t index = entity_index(entity);
+            valid = index < slot_count && !used[index] && generations[index] == entity_generation(entity);
+            if(valid) {
+                used[index] = 1;
+            }
+        }
+
+        for(uint64_t c = 0; c < column_count && valid; c++) {
+            uint64_t hash = in.read<uint64_t>();
+            uint64_t size = in.read<uint64_t>();
+            uint64_t serialized = in.read<uint64_t>();
+            uint64_t byte_count = in.read<uint64_t>();
+            const uint32_t* added_ticks = in.read_array<uint32_t>(archetype.count);
+            const uint32_t* changed_ticks = in.read_array<uint32_t>(archetype.count);
+
+            //the type must be known to this program and stored the same way
+            size_t id = Types::id_of_hash(hash);
+            if(in.failed || id == (size_t)-1 || archetype.signature.contains(id)) {
+                valid = false;
+                break;
+            }
+            const ComponentInfo& info = Types::info(id);
+            if(info.tag || info.size != size || serialized != !info.trivially_copyable || (serialized ? !info.load : byte_count != archetype.count * size)) {
+                valid = false;
+                break;
+            }
+
+            if(!serialized) {
+                in.align(column_alignment);
+            }
+            const char* bytes = in.read_array<char>(byte_count);
+            in.align(8);
+            if(in.failed) {
+                valid = false;
+                break;
+            }
+
+            BaseStorage* storage = info.make_storage();
+            archetype.storages.push_back(storage);
+            archetype.signature.add(id);
+            storage->reserve(archetype.count);
+            storage->reserve_ticks(archetype.count);
+            if(serialized) {
+                MemoryBuffer buffer(bytes, byte_count);
+                std::istream stream(&buffer);
+                valid = info.load(stream, storage, archetype.count) && storage->get_component_count() == archetype.count;
+            } else {
+                storage->push_back_bytes(bytes, archetype.count);
+            }
+            storage->push_ticks(added_ticks, changed_ticks, archetype.count);
+        }
+    }
+
+    //the free indices must be dead, or they would be handed out twice
+    for(uint64_t i = 0; i < free_count && valid; i++) {
+        valid = free[i] < slot_count && used[free[i]] == 0;
+        if(valid) {
+            used[free[i]] = 2;
+        }
+    }
+
+    if(!valid) {
+        delete_storages(loaded);
+        return false;
+    }
+
+    entity_slots.resize(slot_count);
+    for(size_t index = 0; index < slot_count; index++) {
+        entity_slots[index].generation = generations[index];
+    }
+    free_indices.assign(free, free + free_count);
+    change_tick = file_change_tick;
+
+    for(LoadedArchetype& archetype : loaded) {
+
+        //archetypes that already exist are empty, since the set has no entities,
+        //so the rows can be appended. Otherwise the loaded storages become the archetype
+        size_t index = find_archetype(archetype.signature);
+        size_t first_offset = 0;
+        if(index == (size_t)-1) {
+            index = create_archetype(archetype.storages, archetype.tag_ids);
+        } else {
+            Archetype& existing = archetypes[index];
+            first_offset = existing.count();
+            existing.reserve(archetype.count);
+            for(BaseStorage* storage : archetype.storages) {
+                BaseStorage* destination = existing.compound[storage->get_component_type_id()];
+                destination->push_back_range(storage, 0, archetype.count);
+                destination->push_ticks_from(storage, 0, archetype.count);
+                delete storage;
+            }
+        }
+
+        Archetype& destination = archetypes[index];
+        destination.offset_to_entity.insert(destination.offset_to_entity.end(), archetype.entities, archetype.entities + archetype.count);
+        for(size_t i = 0; i < archetype.count; i++) {
+            EntitySlot& slot = entity_slots[entity_index(archetype.entities[i])];
+            slot.archetype_index = index;
+            slot.offset = first_offset + i;
+        }
+    }
+    return true;
+}
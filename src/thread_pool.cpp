@@ -0,0 +1,124 @@
+#include "thread_pool.h"
+#include <algorithm>
+
+using namespace eset;
+
+ThreadPool::ThreadPool(size_t worker_count) {
+
+    if(worker_count == 0) {
+        worker_count = std::max<size_t>(1, std::thread::hardware_concurrency());
+    }
+
+    //the first queue belongs to the thread that calls run
+    for(size_t i = 0; i < worker_count; i++) {
+        m_queues.push_back(std::make_unique<JobQueue>());
+    }
+    for(size_t i = 1; i < worker_count; i++) {
+        m_threads.emplace_back(&ThreadPool::worker_loop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    for(std::thread& thread : m_threads) {
+        thread.join();
+    }
+}
+
+size_t ThreadPool::worker_count() {
+    return m_queues.size();
+}
+
+void ThreadPool::run(size_t job_count, const std::function<void(size_t)>& job) {
+
+    if(job_count == 0) {
+        return;
+    }
+
+    //only one run at a time can use the queues
+    std::lock_guard<std::mutex> run_lock(m_run_mutex);
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_job = &job;
+
+    //give every worker a contiguous range of the jobs to start with
+    size_t queue_count = m_queues.size();
+    for(size_t q = 0; q < queue_count; q++) {
+        std::lock_guard<std::mutex> queue_lock(m_queues[q]->mutex);
+        for(size_t i = job_count * q / queue_count; i < job_count * (q + 1) / queue_count; i++) {
+            m_queues[q]->jobs.push_back(i);
+        }
+    }
+
+    m_generation++;
+    m_active = m_threads.size();
+    lock.unlock();
+    m_wake.notify_all();
+
+    //help out, then wait for the workers that are still busy
+    work(0);
+    lock.lock();
+    m_done.wait(lock, [this]() { return m_active == 0; });
+    m_job = nullptr;
+}
+
+void ThreadPool::worker_loop(size_t queue_index) {
+
+    size_t generation = 0;
+    while(true) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&]() { return m_stop || m_generation != generation; });
+            if(m_stop) {
+                return;
+            }
+            generation = m_generation;
+        }
+
+        work(queue_index);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_active--;
+            if(m_active == 0) {
+                m_done.notify_all();
+            }
+        }
+    }
+}
+
+void ThreadPool::work(size_t queue_index) {
+    size_t job_index;
+    while(pop(queue_index, job_index) || steal(queue_index, job_index)) {
+        (*m_job)(job_index);
+    }
+}
+
+bool ThreadPool::pop(size_t queue_index, size_t& job_index) {
+    JobQueue& queue = *m_queues[queue_index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if(queue.jobs.empty()) {
+        return false;
+    }
+    job_index = queue.jobs.front();
+    queue.jobs.pop_front();
+    return true;
+}
+
+bool ThreadPool::steal(size_t queue_index, size_t& job_index) {
+
+    //take from the back of the other queues, where the owner is least likely to be working
+    for(size_t i = 1; i < m_queues.size(); i++) {
+        JobQueue& queue = *m_queues[(queue_index + i) % m_queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if(!queue.jobs.empty()) {
+            job_index = queue.jobs.back();
+            queue.jobs.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
@@ -1,3 +1,81 @@
 #include "types.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
 
-size_t eset::Types::component_counter = 0;
\ No newline at end of file
+using namespace eset;
+
+namespace {
+
+    //the registry. The infos never move, so they can be read without the lock,
+    //since an id is only handed out after its info has been written
+    struct Registry {
+        std::mutex mutex;
+        std::unordered_map<uint64_t, size_t> hash_to_id;
+        std::unordered_set<uint64_t> ambiguous_hashes;
+        ComponentInfo infos[MAX_COMPONENTS];
+        std::atomic<size_t> count = 0;
+    };
+
+    Registry& registry() {
+        static Registry instance;
+        return instance;
+    }
+}
+
+size_t Types::register_type(const ComponentInfo& info) {
+
+    Registry& types = registry();
+    std::lock_guard<std::mutex> lock(types.mutex);
+
+    //every type gets its own id, even when its name is the same as another's
+    size_t id = types.count.load(std::memory_order_relaxed);
+    if(id >= MAX_COMPONENTS) {
+        std::fprintf(stderr, "eset: too many component types, raise MAX_COMPONENTS\n");
+        std::abort();
+    }
+    types.infos[id] = info;
+
+    //the hash only finds types for loading. Types with the same name, like ones in anonymous
+    //namespaces of different files, can't be told apart by it, so it finds neither of them
+    auto it = types.hash_to_id.find(info.hash);
+    if(it == types.hash_to_id.end()) {
+        types.hash_to_id.emplace(info.hash, id);
+    } else {
+        const ComponentInfo& known = types.infos[it->second];
+        if(known.name != info.name) {
+            std::fprintf(stderr, "eset: the component types %.*s and %.*s have the same hash\n",
+                         (int)known.name.size(), known.name.data(), (int)info.name.size(), info.name.data());
+            std::abort();
+        }
+        types.ambiguous_hashes.insert(info.hash);
+    }
+
+    types.count.store(id + 1, std::memory_order_release);
+    return id;
+}
+
+const ComponentInfo& Types::info(size_t id) {
+    return registry().infos[id];
+}
+
+size_t Types::id_of_hash(uint64_t hash) {
+    Registry& types = registry();
+    std::lock_guard<std::mutex> lock(types.mutex);
+    auto it = types.hash_to_id.find(hash);
+    return it != types.hash_to_id.end() && !types.ambiguous_hashes.contains(hash) ? it->second : -1;
+}
+
+size_t Types::count() {
+    return registry().count.load(std::memory_order_acquire);
+}
+
+void Types::set_serializer(size_t id, void (*save)(const void*, std::ostream&), bool (*load)(std::istream&, BaseStorage*, size_t)) {
+    Registry& types = registry();
+    std::lock_guard<std::mutex> lock(types.mutex);
+    types.infos[id].save = save;
+    types.infos[id].load = load;
+}
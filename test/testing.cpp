@@ -3,6 +3,11 @@
 #include <string>
 #include <chrono>
 #include <functional>
+#include <atomic>
+#include <thread>
+#include <set>
+#include <cstdio>
+#include <fstream>
 #include <stdlib.h>
 #include <eset.h>
 
@@ -164,7 +169,7 @@ void test(eset::Entity entity) {
 bool test_signals_on_destroy() {
 
     eset::Set set;
-    set.connect_on_remove<float>(test);
+    eset::Connection connection = set.connect_on_remove<float>(test);
 
     eset::Entity entity = set.create();
     set.insert<float>(entity, 0.0f);
@@ -177,7 +182,7 @@ bool test_signals_on_destroy() {
     set.insert<float>(entity2, 0.0f);
 
     set.remove(entity);
-    set.disconnect_on_remove<float>(test);
+    set.disconnect_on_remove<float>(connection);
     set.remove(entity2);
 
     return signal_delete_count == 2;
@@ -251,6 +256,59 @@ bool test_reference_set_pointer() {
     return test_return;
 }
 
+bool test_reference_pool() {
+
+    bool test_return = true;
+    std::vector<eset::Ref<size_t>> refs;
+    {
+        eset::Set set;
+        std::vector<eset::Entity> entities = set.create_many<size_t>(1000, 0);
+        for(size_t i = 0; i < entities.size(); i++) {
+            *set.get_raw<size_t>(entities[i]) = i;
+        }
+
+        //reference every third entity, more than fit in one block
+        for(size_t i = 0; i < entities.size(); i += 3) {
+            refs.push_back(set.get<size_t>(entities[i]));
+        }
+
+        //swap-remove and migrate around the referenced rows
+        for(size_t i = 1; i < entities.size(); i += 3) {
+            set.remove(entities[i]);
+        }
+        for(size_t i = 0; i < entities.size(); i += 6) {
+            set.insert<float>(entities[i], 1.0f);
+        }
+        for(size_t i = 0; i < refs.size(); i++) {
+            test_return = test_return && refs[i].valid() && *refs[i].get() == i * 3 && refs[i].entity() == entities[i * 3];
+        }
+
+        //released datas go back to the pool and are reused
+        refs.resize(refs.size() / 2);
+        eset::Ref<size_t> reused = set.get<size_t>(entities[2]);
+        test_return = test_return && reused.valid() && *reused.get() == 2 && reused.reference_count() == 1;
+    }
+
+    //the set is gone, but its blocks live on until the last reference
+    for(eset::Ref<size_t>& ref : refs) {
+        test_return = test_return && !ref.valid() && ref.set() == nullptr;
+    }
+    refs.clear();
+
+    //taking and dropping a reference per entity doesn't touch the other rows each time
+    eset::Set many;
+    std::vector<eset::Entity> entities = many.create_many<size_t>(200000, 7);
+    size_t sum = 0;
+    for(eset::Entity entity : entities) {
+        sum += *many.get<size_t>(entity).get();
+    }
+    eset::Ref<size_t> kept = many.get<size_t>(entities.back());
+    many.remove(entities[0]);
+    many.insert<float>(entities[1], 1.0f);
+    test_return = test_return && sum == 200000 * 7 && kept.valid() && kept.entity() == entities.back() && *kept.get() == 7;
+    return test_return;
+}
+
 bool test_multiple_storage_references() {
 
     eset::Set set;
@@ -273,6 +331,1011 @@ bool test_multiple_storage_references() {
     return *ref1.get() == 10.0f && *ref2.get() == 20.0f && *ref3.get() == 30.0f && *ref4.get() == 40.0f;
 }
 
+template<size_t N>
+struct Layer {
+    size_t value;
+};
+
+template<size_t... N>
+bool insert_layers(eset::Set& set, eset::Entity entity, std::index_sequence<N...>) {
+    return set.insert<Layer<N>...>(entity, Layer<N>{N}...);
+}
+
+bool test_wide_signatures() {
+
+    //more components on one entity than the old signature could hold
+    eset::Set set;
+    eset::Entity entity = set.create();
+    bool test_return = insert_layers(set, entity, std::make_index_sequence<40>{});
+    test_return = test_return && set.get_raw<Layer<39>>(entity)->value == 39 && set.get_raw<Layer<0>>(entity)->value == 0;
+    test_return = test_return && set.remove_component<Layer<20>>(entity) && set.get_raw<Layer<20>>(entity) == nullptr;
+
+    //the same components added in another order find the same archetype
+    eset::Entity other = set.create();
+    set.insert<Layer<1>, Layer<0>>(other, {1}, {0});
+    eset::Entity reversed = set.create();
+    set.insert<Layer<0>, Layer<1>>(reversed, {0}, {1});
+    size_t both = 0;
+    for(auto [e, first, second] : set.iterator<Layer<0>, Layer<1>>().without<Layer<2>>()) {
+        both++;
+    }
+
+    //signatures count, compare and match by words
+    eset::FastSignature low;
+    eset::FastSignature high;
+    low.add(3);
+    low.add(3);
+    high.add(3);
+    high.add(MAX_COMPONENTS - 1);
+    test_return = test_return && low.count() == 1 && high.count() == 2 && high.contains(low) && !low.contains(high);
+    test_return = test_return && high.intersects(low) && !(low == high) && high.contains(MAX_COMPONENTS - 1);
+    low.add(MAX_COMPONENTS - 1);
+    test_return = test_return && low == high && low.hash() == high.hash();
+
+    return test_return && both == 2;
+}
+
+bool test_archetype_transitions() {
+
+    eset::Set set;
+    std::vector<eset::Entity> entities;
+
+    //insert the same components in different orders, so the archetypes
+    //are found both through cached transitions and through the signature lookup
+    for(size_t i = 0; i < 64; i++) {
+        eset::Entity entity = set.create();
+        if(i & 1) set.insert<Layer<0>>(entity, {i});
+        if(i & 2) set.insert<Layer<1>>(entity, {i});
+        if(i & 4) set.insert<Layer<2>>(entity, {i});
+        set.insert<float>(entity, (float)i);
+        if(i & 8) set.insert<Layer<3>>(entity, {i});
+        if(i & 16) set.insert<Layer<1>>(entity, {i});
+        if(i & 32) set.insert<Layer<0>>(entity, {i});
+        entities.push_back(entity);
+    }
+
+    bool test_return = true;
+    for(size_t i = 0; i < entities.size(); i++) {
+        eset::Entity entity = entities[i];
+        test_return = test_return && *set.get_raw<float>(entity) == (float)i;
+        test_return = test_return && ((i & 33) != 0) == (set.get_raw<Layer<0>>(entity) != nullptr);
+        test_return = test_return && ((i & 18) != 0) == (set.get_raw<Layer<1>>(entity) != nullptr);
+        test_return = test_return && ((i & 8) != 0) == (set.get_raw<Layer<3>>(entity) != nullptr);
+    }
+
+    size_t count = 0;
+    for(auto [entity_id, layer, number] : set.iterator<Layer<0>, float>()) {
+        test_return = test_return && layer.value == (size_t)number;
+        count++;
+    }
+
+    return test_return && count == 48;
+}
+
+struct LifetimeComponent {
+    static int alive;
+    LifetimeComponent() {alive++;}
+    LifetimeComponent(const LifetimeComponent& other) {alive++;}
+    LifetimeComponent& operator=(const LifetimeComponent& other) = default;
+    ~LifetimeComponent() {alive--;}
+};
+int LifetimeComponent::alive = 0;
+
+bool test_remove_component() {
+
+    eset::Set set;
+    signal_delete_count = 0;
+    set.connect_on_remove<LifetimeComponent>(test);
+
+    eset::Entity entity1 = set.create();
+    eset::Entity entity2 = set.create();
+    set.insert<float>(entity1, 10.0f);
+    set.insert<LifetimeComponent>(entity1, LifetimeComponent());
+    set.insert<float>(entity2, 20.0f);
+    set.insert<LifetimeComponent>(entity2, LifetimeComponent());
+
+    eset::Ref<float> ref1 = set.get<float>(entity1);
+    eset::Ref<float> ref2 = set.get<float>(entity2);
+    eset::Ref<LifetimeComponent> removed_ref = set.get<LifetimeComponent>(entity1);
+
+    //removing from entity1 swaps entity2 into its old row
+    bool test_return = set.remove_component<LifetimeComponent>(entity1);
+    test_return = test_return && !set.remove_component<LifetimeComponent>(entity1);
+    test_return = test_return && set.get_raw<LifetimeComponent>(entity1) == nullptr;
+    test_return = test_return && set.get_raw<LifetimeComponent>(entity2) != nullptr;
+    test_return = test_return && !removed_ref.valid() && LifetimeComponent::alive == 1 && signal_delete_count == 1;
+    test_return = test_return && ref1.valid() && *ref1.get() == 10.0f && ref1.entity() == entity1;
+    test_return = test_return && ref2.valid() && *ref2.get() == 20.0f && ref2.entity() == entity2;
+
+    //back and forth again through the cached transitions
+    set.insert<LifetimeComponent>(entity1, LifetimeComponent());
+    test_return = test_return && set.remove_component<LifetimeComponent>(entity2);
+    test_return = test_return && set.remove_component<float>(entity2);
+    test_return = test_return && !ref2.valid() && ref1.valid() && *ref1.get() == 10.0f;
+    test_return = test_return && set.exist(entity2) && LifetimeComponent::alive == 1 && signal_delete_count == 2;
+
+    //an observer that changes the entity decides where it ends up
+    eset::Set changing;
+    eset::Entity entity3 = changing.create();
+    changing.insert<float, int>(entity3, 1.0f, 2);
+    changing.connect_on_remove<int>([&changing](eset::Entity entity) { changing.remove_component<float>(entity); });
+    test_return = test_return && changing.remove_component<int>(entity3);
+    test_return = test_return && changing.get_raw<float>(entity3) == nullptr && changing.get_raw<int>(entity3) == nullptr;
+    for(auto [entity, decimal] : changing.iterator<float>()) {
+        test_return = false;
+    }
+
+    return test_return;
+}
+
+bool test_lookup_after_removal() {
+
+    eset::Set set;
+    std::vector<eset::Entity> entities;
+    for(size_t i = 0; i < 100; i++) {
+        eset::Entity entity = set.create();
+        set.insert<size_t>(entity, i);
+        entities.push_back(entity);
+    }
+
+    //removing from the middle swaps the last entities into the holes
+    for(size_t i = 0; i < 100; i += 3) {
+        set.remove(entities[i]);
+    }
+
+    bool test_return = true;
+    for(size_t i = 0; i < 100; i++) {
+        size_t* number = set.get_raw<size_t>(entities[i]);
+        if(i % 3 == 0) {
+            test_return = test_return && number == nullptr && !set.exist(entities[i]);
+        } else {
+            test_return = test_return && number != nullptr && *number == i;
+        }
+    }
+
+    return test_return && !set.exist(eset::null) && !set.exist(1000);
+}
+
+bool test_create_while_removing() {
+
+    //observers can create entities while one is being removed
+    eset::Set set;
+    eset::Entity spawner = set.create();
+    set.insert<float>(spawner, 0.0f);
+    set.connect_on_remove<float>([&set](eset::Entity entity) {
+        for(size_t i = 0; i < 1000; i++) {
+            set.create();
+        }
+    });
+
+    return set.remove(spawner) && !set.exist(spawner) && set.stats().entity_count == 1000;
+}
+
+bool test_entity_recycling() {
+
+    eset::Set set;
+    eset::Entity entity1 = set.create();
+    set.insert<float>(entity1, 1.0f);
+    set.remove(entity1);
+
+    //the index is reused, but the old handle must stay dead
+    eset::Entity entity2 = set.create();
+    set.insert<float>(entity2, 2.0f);
+
+    bool test_return = entity1 != entity2;
+    test_return = test_return && eset::entity_index(entity1) == eset::entity_index(entity2);
+    test_return = test_return && eset::entity_generation(entity2) == eset::entity_generation(entity1) + 1;
+    test_return = test_return && !set.exist(entity1) && set.exist(entity2);
+    test_return = test_return && set.get_raw<float>(entity1) == nullptr && *set.get_raw<float>(entity2) == 2.0f;
+    test_return = test_return && !set.remove(entity1) && !set.insert<int>(entity1, 0);
+    test_return = test_return && set.exist(entity2);
+
+    return test_return;
+}
+
+bool test_create_many() {
+
+    struct Position {
+        float x;
+        float y;
+    };
+
+    eset::Set set;
+
+    //an entity built the usual way shares the archetype with the batch
+    eset::Entity single = set.create();
+    set.insert<Position>(single, {1.0f, 2.0f});
+    set.insert<std::string>(single, "single");
+    set.remove(set.create());
+
+    std::vector<eset::Entity> entities = set.create_many<Position, std::string>(1000, {3.0f, 4.0f}, "batch");
+    std::span<const eset::Entity> more = set.create_many_span<Position, std::string>(10, {5.0f, 6.0f}, "span");
+
+    bool test_return = entities.size() == 1000 && more.size() == 10;
+    test_return = test_return && set.exist(more[0]) && set.get_raw<Position>(more[9])->x == 5.0f;
+    for(eset::Entity entity : entities) {
+        test_return = test_return && set.exist(entity) && set.get_raw<Position>(entity)->y == 4.0f && *set.get_raw<std::string>(entity) == "batch";
+    }
+
+    size_t count = 0;
+    for(auto [entity_id, position, name] : set.iterator<Position, std::string>()) {
+        count++;
+    }
+
+    //the batch entities behave like any other entity
+    set.remove_component<std::string>(entities[10]);
+    test_return = test_return && set.get_raw<std::string>(entities[10]) == nullptr && set.get_raw<Position>(entities[10])->x == 3.0f;
+    test_return = test_return && set.get_raw<Position>(single)->x == 1.0f;
+
+    return test_return && count == 1011;
+}
+
+bool test_multi_insert() {
+
+    eset::Set set;
+    eset::Entity entity = set.create();
+    set.insert<float>(entity, 1.0f);
+    eset::Ref<float> ref = set.get<float>(entity);
+
+    //int and std::string are new, float gets overwritten
+    bool test_return = set.insert<int, float, std::string>(entity, 2, 3.0f, "three");
+    test_return = test_return && *set.get_raw<int>(entity) == 2 && *set.get_raw<float>(entity) == 3.0f;
+    test_return = test_return && *set.get_raw<std::string>(entity) == "three";
+    test_return = test_return && ref.valid() && *ref.get() == 3.0f;
+
+    //a second entity takes the same path and ends up in the same archetype
+    eset::Entity entity2 = set.create();
+    test_return = test_return && set.insert<std::string, int, float>(entity2, "four", 4, 4.0f);
+    test_return = test_return && !set.insert<int, float>(eset::null, 0, 0.0f);
+
+    size_t count = 0;
+    for(auto [entity_id, number, decimal, text] : set.iterator<int, float, std::string>()) {
+        test_return = test_return && (float)number == decimal - (entity_id == entity ? 1.0f : 0.0f);
+        count++;
+    }
+
+    return test_return && count == 2;
+}
+
+struct ChunkedComponent {
+    size_t value;
+};
+
+template<> struct eset::StorageType<ChunkedComponent> {
+    using type = eset::ChunkedStorage<ChunkedComponent, 64>;
+};
+
+bool test_chunked_storage() {
+
+    eset::Set set;
+    std::vector<eset::Entity> entities = set.create_many<ChunkedComponent>(100, {0});
+    for(size_t i = 0; i < 1000; i++) {
+        eset::Entity entity = set.create();
+        set.insert<float, ChunkedComponent>(entity, (float)i, {i});
+        entities.push_back(entity);
+    }
+
+    //growing the storage must not move the components that already exist
+    ChunkedComponent* first = set.get_raw<ChunkedComponent>(entities[100]);
+    for(size_t i = 0; i < 1000; i++) {
+        set.insert<float, ChunkedComponent>(set.create(), 0.0f, {0});
+    }
+    bool test_return = first == set.get_raw<ChunkedComponent>(entities[100]);
+    test_return = test_return && ((uintptr_t)first % 64) == 0;
+
+    for(size_t i = 100; i < entities.size(); i += 2) {
+        set.remove(entities[i]);
+    }
+    for(size_t i = 101; i < entities.size(); i += 2) {
+        test_return = test_return && set.get_raw<ChunkedComponent>(entities[i])->value == i - 100;
+    }
+
+    size_t count = 0;
+    for(auto [entity_id, chunked, number] : set.iterator<ChunkedComponent, float>()) {
+        test_return = test_return && chunked.value == (size_t)number;
+        count++;
+    }
+
+    return test_return && count == 1500;
+}
+
+bool test_insert_many() {
+
+    eset::Set set;
+    std::vector<eset::Entity> entities = set.create_many<size_t, ChunkedComponent, std::string>(1000, 0, {0}, "text");
+    for(size_t i = 0; i < entities.size(); i++) {
+        *set.get_raw<size_t>(entities[i]) = i;
+        set.get_raw<ChunkedComponent>(entities[i])->value = i;
+    }
+    eset::Ref<size_t> moved_ref = set.get<size_t>(entities[2]);
+    eset::Ref<size_t> filler_ref = set.get<size_t>(entities[999]);
+
+    //scattered runs of rows, some given twice, from the middle and the end of the archetype
+    std::vector<eset::Entity> chosen;
+    for(size_t i = 0; i < entities.size(); i++) {
+        if(i % 7 < 3 || i > 900) {
+            chosen.push_back(entities[i]);
+        }
+    }
+    chosen.push_back(entities[0]);
+    chosen.push_back(eset::null);
+    size_t inserted = set.insert_many<float, size_t>(chosen, 1.0f, 7);
+
+    //every entity must still have its own components, and the chosen ones the new ones
+    bool test_return = inserted == chosen.size() - 2;
+    for(size_t i = 0; i < entities.size(); i++) {
+        bool was_chosen = i % 7 < 3 || i > 900;
+        float* decimal = set.get_raw<float>(entities[i]);
+        test_return = test_return && set.get_raw<ChunkedComponent>(entities[i])->value == i;
+        test_return = test_return && *set.get_raw<std::string>(entities[i]) == "text";
+        test_return = test_return && *set.get_raw<size_t>(entities[i]) == (was_chosen ? 7 : i);
+        test_return = test_return && (was_chosen ? decimal && *decimal == 1.0f : decimal == nullptr);
+    }
+    test_return = test_return && moved_ref.valid() && *moved_ref.get() == 7 && moved_ref.entity() == entities[2];
+    test_return = test_return && filler_ref.valid() && *filler_ref.get() == 7;
+
+    //a second time moves nothing, only overwrites
+    test_return = test_return && set.insert_many<float>(chosen, 2.0f) == inserted && *set.get_raw<float>(entities[0]) == 2.0f;
+    return test_return;
+}
+
+bool test_each_chunk() {
+
+    eset::Set set;
+    set.create_many<float, ChunkedComponent>(200, 1.0f, {2});
+    set.create_many<float, ChunkedComponent, int>(100, 1.0f, {3}, 0);
+    set.create_many<float>(50, 100.0f);
+
+    size_t chunks = 0;
+    size_t entities = 0;
+    size_t sum = 0;
+    bool test_return = true;
+    set.each_chunk<float, ChunkedComponent>([&](std::span<const eset::Entity> entity_span, std::span<float> floats, std::span<ChunkedComponent> chunked) {
+        test_return = test_return && entity_span.size() == floats.size() && floats.size() == chunked.size();
+        test_return = test_return && entity_span.size() <= 64; //never crosses a block of the chunked storage
+        for(size_t i = 0; i < floats.size(); i++) {
+            floats[i] += 1.0f;
+            sum += chunked[i].value;
+        }
+        chunks++;
+        entities += entity_span.size();
+    });
+
+    for(auto [entity_id, decimal, chunked] : set.iterator<float, ChunkedComponent>()) {
+        test_return = test_return && decimal == 2.0f;
+    }
+
+    return test_return && chunks == 6 && entities == 300 && sum == 700;
+}
+
+bool test_parallel_iteration() {
+
+    eset::Set set;
+    set.set_worker_count(4);
+    set.create_many<float, size_t>(100000, 1.0f, 1);
+    set.create_many<float, size_t, int>(5000, 1.0f, 2, 0);
+    set.create_many<float, ChunkedComponent, size_t>(3000, 1.0f, {0}, 3);
+    set.create_many<float>(1000, 0.0f);
+
+    std::atomic<size_t> visited = 0;
+    set.par_each<float, size_t>([&](eset::Entity entity, float& decimal, size_t& number) {
+        decimal += (float)number;
+        visited++;
+    });
+
+    std::atomic<size_t> chunk_entities = 0;
+    set.par_each_chunk<float, ChunkedComponent>([&](std::span<const eset::Entity> entities, std::span<float> decimals, std::span<ChunkedComponent> chunked) {
+        for(size_t i = 0; i < decimals.size(); i++) {
+            decimals[i] += 1.0f;
+        }
+        chunk_entities += entities.size();
+    });
+
+    bool test_return = visited == 108000 && chunk_entities == 3000;
+    for(auto [entity_id, decimal, number] : set.iterator<float, size_t>()) {
+        float expected = 1.0f + (float)number + (number == 3 ? 1.0f : 0.0f);
+        test_return = test_return && decimal == expected;
+    }
+
+    return test_return;
+}
+
+bool test_query() {
+
+    eset::Set set;
+    set.create_many<float, int>(10, 1.0f, 1);
+
+    eset::Query<float, int> query(set);
+    bool test_return = query.set() == &set && query.archetype_count() == 1;
+
+    //archetypes made after the query are picked up as they are created
+    set.create_many<float, int, size_t>(5, 2.0f, 2, 0);
+    set.create_many<float>(5, 3.0f);
+    eset::Entity entity = set.create();
+    set.insert<int, float, std::string>(entity, 3, 3.0f, "three");
+    test_return = test_return && query.archetype_count() == 3;
+
+    size_t count = 0;
+    for(auto [entity_id, decimal, number] : query.iterator()) {
+        test_return = test_return && decimal == (float)number;
+        count++;
+    }
+
+    size_t chunk_count = 0;
+    query.each_chunk([&](std::span<const eset::Entity> entities, std::span<float> decimals, std::span<int> numbers) {
+        chunk_count += entities.size();
+    });
+
+    //a query outliving its set doesn't point to it anymore
+    eset::Query<float>* orphan;
+    {
+        eset::Set other_set;
+        other_set.create_many<float>(10, 4.0f);
+        orphan = new eset::Query<float>(other_set);
+    }
+    test_return = test_return && orphan->set() == nullptr && orphan->archetype_count() == 0;
+    for(auto [entity_id, decimal] : orphan->iterator()) {
+        test_return = false;
+    }
+    for(auto [entity_id, decimal] : orphan->iterator().without<int>().changed<float>(0)) {
+        test_return = false;
+    }
+    delete orphan;
+
+    return test_return && count == 16 && chunk_count == 16;
+}
+
+template<size_t N>
+struct Variant {};
+
+template<size_t... N>
+void create_variants(eset::Set& set, std::index_sequence<N...>) {
+    ((set.insert<Variant<N>, size_t>(set.create(), Variant<N>(), N)), ...);
+}
+
+bool test_many_archetypes_iteration() {
+
+    //more matching archetypes than the old iterator could hold, with empty ones in between
+    eset::Set set;
+    create_variants(set, std::make_index_sequence<200>{});
+    for(size_t i = 0; i < 200; i += 7) {
+        set.remove(eset::make_entity(i + 1, 0));
+    }
+
+    auto iterator = set.iterator<size_t>();
+    size_t count = 0;
+    size_t sum = 0;
+    for(auto [entity_id, number] : iterator) {
+        sum += number;
+        count++;
+    }
+
+    //iterating again reuses the same archetype list
+    size_t second_count = 0;
+    for(auto [entity_id, number] : set.iterator<size_t>()) {
+        second_count++;
+    }
+
+    size_t expected_sum = 0;
+    for(size_t i = 0; i < 200; i++) {
+        if(i % 7 != 0) {
+            expected_sum += i;
+        }
+    }
+
+    return count == 171 && second_count == 171 && sum == expected_sum && sizeof(iterator) <= 12 * sizeof(void*);
+}
+
+bool test_query_filters() {
+
+    struct Dead {};
+    struct Velocity {
+        float value;
+    };
+
+    eset::Set set;
+    set.create_many<float>(10, 1.0f);
+    set.create_many<float, Velocity>(20, 1.0f, {2.0f});
+    set.create_many<float, Dead>(30, 1.0f, {});
+    set.create_many<float, Velocity, Dead>(40, 1.0f, {2.0f}, {});
+    set.create_many<float, int>(50, 1.0f, 0);
+
+    size_t alive = 0;
+    for(auto [entity, decimal] : set.iterator<float>().without<Dead>()) {
+        alive++;
+    }
+
+    size_t alive_without_int = 0;
+    for(auto [entity, decimal] : set.iterator<float>().without<Dead>().without<int>()) {
+        alive_without_int++;
+    }
+
+    size_t with_velocity = 0;
+    size_t without_velocity = 0;
+    bool test_return = true;
+    for(auto [entity, decimal, velocity] : set.iterator<float, eset::Optional<Velocity>>().without<Dead>()) {
+        if(velocity) {
+            test_return = test_return && velocity->value == 2.0f;
+            with_velocity++;
+        } else {
+            without_velocity++;
+        }
+    }
+
+    eset::Query<eset::Optional<Dead>, Velocity> query(set);
+    size_t dead = 0;
+    size_t total = 0;
+    for(auto [entity, tag, velocity] : query.iterator()) {
+        dead += tag != nullptr;
+        total++;
+    }
+
+    return test_return && alive == 80 && alive_without_int == 30 && with_velocity == 20 && without_velocity == 60 && dead == 40 && total == 60;
+}
+
+bool test_change_detection() {
+
+    eset::Set set;
+    std::vector<eset::Entity> entities = set.create_many<float, int>(100, 0.0f, 0);
+    set.create_many<float>(100, 0.0f);
+
+    //everything is new the first time a system runs
+    uint32_t last_run = 0;
+    size_t first = 0;
+    for(auto [entity, decimal] : set.iterator<float>().changed<int>(last_run)) {
+        first++;
+    }
+    last_run = set.advance_tick();
+
+    //nothing happened since
+    size_t second = 0;
+    for(auto [entity, decimal] : set.iterator<float>().changed<int>(last_run)) {
+        second++;
+    }
+
+    //overwrite through insert, mark a write through a pointer, migrate one entity and swap-remove another
+    set.insert<int>(entities[3], 3);
+    *set.get_raw<int>(entities[50]) = 50;
+    set.mark_changed<int>(entities[50]);
+    set.insert<std::string>(entities[99], "moved");
+    set.remove(entities[0]);
+    eset::Entity added = set.create();
+    set.insert<int>(added, 1);
+
+    size_t changed_sum = 0;
+    size_t changed_count = 0;
+    for(auto [entity, number] : set.iterator<int>().changed<int>(last_run)) {
+        changed_sum += number;
+        changed_count++;
+    }
+
+    size_t added_count = 0;
+    for(auto [entity, number] : set.iterator<int>().added<int>(last_run).without<std::string>()) {
+        added_count++;
+    }
+
+    //chained filters all have to pass
+    set.mark_changed<float>(entities[3]);
+    set.mark_changed<float>(entities[7]);
+    std::vector<eset::Entity> both;
+    for(auto [entity, decimal, number] : set.iterator<float, int>().changed<int>(last_run).changed<float>(last_run)) {
+        both.push_back(entity);
+    }
+    for(auto [entity, decimal, number] : set.iterator<float, int>().changed<float>(last_run).changed<int>(last_run)) {
+        both.push_back(entity);
+    }
+
+    return first == 100 && second == 0 && changed_count == 3 && changed_sum == 54 && added_count == 1 && both == std::vector<eset::Entity>{entities[3], entities[3]};
+}
+
+bool test_command_buffer() {
+
+    eset::Set set;
+    signal_delete_count = 0;
+    set.connect_on_remove<LifetimeComponent>(test);
+    std::vector<eset::Entity> entities = set.create_many<int, LifetimeComponent>(100, 0, LifetimeComponent());
+    eset::Ref<int> kept_ref = set.get<int>(entities[1]);
+
+    //record from two threads at once, each into its own buffer
+    eset::CommandBuffer buffers[2];
+    std::thread threads[2];
+    for(size_t t = 0; t < 2; t++) {
+        threads[t] = std::thread([&, t]() {
+            for(size_t i = t; i < entities.size(); i += 2) {
+                if(i % 10 == 0) {
+                    buffers[t].remove(entities[i]);
+                } else if(i % 3 == 0) {
+                    buffers[t].insert<float, int>(entities[i], 1.0f, 1);
+                    buffers[t].insert<float>(entities[i], 2.0f);
+                    buffers[t].remove_component<LifetimeComponent>(entities[i]);
+                }
+            }
+        });
+    }
+    for(std::thread& thread : threads) {
+        thread.join();
+    }
+
+    //new entities can be used inside the buffer before they exist
+    eset::Entity pending = buffers[0].create();
+    buffers[0].insert<std::string, int>(pending, "new", 7);
+    eset::Entity discarded = buffers[0].create();
+    buffers[0].insert<int>(discarded, 0);
+    buffers[0].remove(discarded);
+
+    std::vector<eset::Entity> created = buffers[0].flush(set);
+    buffers[1].flush(set);
+    bool test_return = buffers[0].size() == 0 && created.size() == 2 && created[1] == eset::null;
+    test_return = test_return && set.exist(created[0]) && *set.get_raw<std::string>(created[0]) == "new";
+
+    //60 of the entities are untouched, 10 removed and 30 moved to float, int
+    size_t untouched = 0;
+    for(auto [entity, number, lifetime] : set.iterator<int, LifetimeComponent>()) {
+        untouched++;
+    }
+    size_t moved = 0;
+    float float_sum = 0.0f;
+    for(auto [entity, decimal, number] : set.iterator<float, int>()) {
+        moved++;
+        float_sum += decimal;
+        test_return = test_return && number == 1;
+    }
+
+    test_return = test_return && !set.exist(entities[0]) && !set.exist(entities[90]);
+    test_return = test_return && kept_ref.valid() && kept_ref.entity() == entities[1];
+
+    //observers that change the entities are respected by the rest of the flush
+    eset::Set changing;
+    std::vector<eset::Entity> pair = {changing.create_many<float, int>(1, 1.0f, 1)[0], changing.create_many<float>(1, 1.0f)[0]};
+    changing.connect_on_remove<int>([&changing](eset::Entity entity) { changing.remove_component<float>(entity); });
+    changing.connect_on_insert<size_t>([&changing, &pair](eset::Entity entity) { changing.remove(pair[1]); });
+    eset::CommandBuffer changes;
+    changes.remove_component<int>(pair[0]);
+    changes.insert<size_t>(pair[0], 0);
+    changes.insert<size_t, double>(pair[1], 0, 0.0);
+    changes.flush(changing);
+    test_return = test_return && changing.get_raw<float>(pair[0]) == nullptr && changing.get_raw<int>(pair[0]) == nullptr;
+    test_return = test_return && changing.get_raw<size_t>(pair[0]) != nullptr && !changing.exist(pair[1]);
+    for(auto [entity, decimal] : changing.iterator<float>()) {
+        test_return = false;
+    }
+
+    return test_return && untouched == 60 && moved == 30 && float_sum == 60.0f && LifetimeComponent::alive == 60 && signal_delete_count == 40;
+}
+
+template<size_t N>
+struct ThreadType {
+    std::string text;
+};
+
+bool test_type_registry() {
+
+    //the stable hashes are known at compile time and differ per type
+    constexpr uint64_t float_hash = eset::Types::type_hash<float>();
+    static_assert(float_hash != eset::Types::type_hash<int>());
+    static_assert(eset::Types::type_name<Layer<3>>() == "Layer<3>");
+
+    //types first used by several threads at once still get one id each
+    std::vector<size_t> ids[4];
+    std::vector<std::thread> threads;
+    for(size_t t = 0; t < 4; t++) {
+        threads.emplace_back([&ids, t]() {
+            ids[t] = {eset::Types::type_id<ThreadType<0>>(), eset::Types::type_id<ThreadType<1>>(),
+                      eset::Types::type_id<ThreadType<2>>(), eset::Types::type_id<ThreadType<3>>()};
+        });
+    }
+    for(std::thread& thread : threads) {
+        thread.join();
+    }
+    bool test_return = ids[0] == ids[1] && ids[1] == ids[2] && ids[2] == ids[3];
+    test_return = test_return && std::set<size_t>(ids[0].begin(), ids[0].end()).size() == 4;
+
+    size_t id = eset::Types::type_id<ThreadType<2>>();
+    const eset::ComponentInfo& info = eset::Types::info(id);
+    test_return = test_return && eset::Types::id_of_hash(info.hash) == id && eset::Types::id_of_hash(0) == (size_t)-1;
+    test_return = test_return && info.size == sizeof(ThreadType<2>) && info.alignment == alignof(ThreadType<2>);
+    test_return = test_return && !info.trivially_copyable && eset::Types::info(eset::Types::type_id<float>()).trivially_copyable;
+    test_return = test_return && eset::Types::info(eset::Types::type_id<float>()).hash == float_hash;
+
+    //types of the same name still get an id each, but can't be found by their hash
+    auto first = []() { struct Health { int value; }; return eset::Types::type_id<Health>(); };
+    auto second = []() { struct Health { int value; }; return eset::Types::type_id<Health>(); };
+    size_t first_id = first();
+    size_t second_id = second();
+    test_return = test_return && first_id != second_id;
+    if(eset::Types::info(first_id).name == eset::Types::info(second_id).name) {
+        test_return = test_return && eset::Types::id_of_hash(eset::Types::info(first_id).hash) == (size_t)-1;
+    }
+
+    //the factory makes storages of the right type
+    eset::BaseStorage* storage = info.make_storage();
+    test_return = test_return && storage->get_component_type_id() == id && storage->get_component_size() == sizeof(ThreadType<2>);
+    delete storage;
+
+    return test_return && eset::Types::count() > id;
+}
+
+bool test_stats() {
+
+    eset::Set set;
+    std::vector<eset::Entity> entities = set.create_many<float, int>(100, 1.0f, 1);
+    eset::Ref<float> ref = set.get<float>(entities[0]);
+
+    //one migration, a removal from the middle and one from the end, which doesn't swap
+    set.insert<std::string>(entities[10], "moved");
+    set.remove(entities[20]);
+    set.remove(entities[97]);
+
+    eset::SetStats stats = set.stats();
+    bool test_return = stats.archetype_count == 3 && stats.empty_archetype_count == 1 && stats.entity_count == 98;
+    test_return = test_return && stats.migrations == 1 && stats.swap_removes == 2 && stats.live_references == 1;
+
+    //the float and int archetype: both columns are listed, with their names and sizes
+    eset::ArchetypeStats& archetype = stats.archetypes[1];
+    test_return = test_return && archetype.entities == 97 && archetype.column_count == 2;
+    for(size_t i = archetype.first_column; i < archetype.first_column + archetype.column_count; i++) {
+        eset::ColumnStats& column = stats.columns[i];
+        test_return = test_return && column.count == 97 && column.capacity >= 97 && column.bytes >= 97 * column.component_size;
+        test_return = test_return && (column.name == "float" || column.name == "int") && column.slack_bytes < column.bytes;
+    }
+    test_return = test_return && stats.bytes > stats.slack_bytes && archetype.bytes >= archetype.slack_bytes;
+
+    //only the first lookup of a new layout misses
+    size_t misses = stats.find_archetype_misses;
+    set.insert<std::string>(entities[11], "moved");
+    set.reset_counters();
+    set.insert<double>(entities[12], 1.0);
+    stats = set.stats();
+    return test_return && misses >= 1 && stats.migrations == 1 && stats.find_archetype_misses == 1;
+}
+
+bool test_observers() {
+
+    eset::Set set;
+    size_t inserted = 0;
+    size_t removed = 0;
+    std::vector<size_t> insert_batches;
+    std::vector<size_t> remove_batches;
+    set.connect_on_insert<float>([&](eset::Entity entity) { inserted++; });
+    set.connect_on_remove<float>([&](eset::Entity entity) { removed += set.get_raw<float>(entity) != nullptr; });
+    set.connect_on_insert_batch<float>([&](std::span<const eset::Entity> entities) { insert_batches.push_back(entities.size()); });
+    set.connect_on_remove_batch<float>([&](std::span<const eset::Entity> entities) { remove_batches.push_back(entities.size()); });
+
+    //single inserts fire once per new component, overwriting doesn't fire
+    eset::Entity entity = set.create();
+    set.insert<float, int>(entity, 1.0f, 1);
+    set.insert<float>(entity, 2.0f);
+    bool test_return = inserted == 1 && insert_batches.empty();
+
+    //bulk creation and insertion fire once per entity, but the batches wait for a flush
+    std::vector<eset::Entity> entities = set.create_many<float>(100, 1.0f);
+    std::vector<eset::Entity> plain = set.create_many<int>(50, 1);
+    set.insert_many<float, int>(plain, 1.0f, 2);
+    set.flush_observers();
+    test_return = test_return && inserted == 151 && insert_batches.size() == 1 && insert_batches[0] == 151;
+
+    //removing through a command buffer is a single batch, and the components can
+    //still be read by the observers that are called per entity
+    eset::CommandBuffer commands;
+    for(eset::Entity removed_entity : entities) {
+        commands.remove(removed_entity);
+    }
+    commands.remove_component<float>(entity);
+    commands.flush(set);
+    test_return = test_return && removed == 101 && remove_batches.size() == 1 && remove_batches[0] == 101;
+
+    //nothing is left to deliver
+    set.flush_observers();
+    test_return = test_return && insert_batches.size() == 1 && remove_batches.size() == 1;
+
+    //an observer can remove another entity of the same archetype
+    eset::Set siblings;
+    std::vector<eset::Entity> family = siblings.create_many<double, int>(4, 1.0, 0);
+    for(int i = 0; i < 4; i++) {
+        *siblings.get_raw<int>(family[i]) = i;
+    }
+    siblings.connect_on_remove<double>([&siblings, &family](eset::Entity entity) {
+        if(entity == family[3]) {
+            siblings.remove(family[0]);
+        }
+    });
+    siblings.remove(family[3]);
+    test_return = test_return && !siblings.exist(family[0]) && !siblings.exist(family[3]);
+    test_return = test_return && *siblings.get_raw<int>(family[1]) == 1 && *siblings.get_raw<int>(family[2]) == 2;
+    size_t left = 0;
+    for(auto [sibling, decimal, number] : siblings.iterator<double, int>()) {
+        test_return = test_return && sibling == family[number];
+        left++;
+    }
+    test_return = test_return && left == 2;
+
+    //an observer can create more entities in the archetype that is being filled
+    eset::Set growing;
+    size_t nested = 0;
+    growing.connect_on_insert<float>([&growing, &nested](eset::Entity entity) {
+        if(nested++ == 0) {
+            growing.create_many<float>(1000, 2.0f);
+            growing.create_many_span<float>(10, 3.0f);
+        }
+    });
+    std::vector<eset::Entity> first = growing.create_many<float>(4, 1.0f);
+    std::span<const eset::Entity> second = growing.create_many_span<float>(4, 1.0f);
+    for(size_t i = 0; i < 4; i++) {
+        test_return = test_return && *growing.get_raw<float>(first[i]) == 1.0f && *growing.get_raw<float>(second[i]) == 1.0f;
+    }
+    test_return = test_return && first.size() == 4 && second.size() == 4 && nested == 1018 && growing.stats().entity_count == 1018;
+
+    //every connected function is called, and disconnecting only removes its own connection
+    eset::Set lambdas;
+    size_t a = 0;
+    size_t b = 0;
+    eset::Connection first_connection = lambdas.connect_on_insert<float>([&a](eset::Entity entity) { a++; });
+    eset::Connection second_connection = lambdas.connect_on_insert<float>([&b](eset::Entity entity) { b++; });
+    lambdas.create_many<float>(1, 1.0f);
+    test_return = test_return && first_connection != second_connection && a == 1 && b == 1;
+    test_return = test_return && lambdas.disconnect_on_insert<float>(second_connection) && !lambdas.disconnect_on_insert<float>(second_connection);
+    lambdas.create_many<float>(1, 1.0f);
+    return test_return && a == 2 && b == 1 && !lambdas.disconnect_on_remove<float>(first_connection);
+}
+
+struct Frozen {};
+struct Selected {};
+
+bool test_tags() {
+
+    eset::Set set;
+    size_t unfrozen = 0;
+    set.connect_on_remove<Frozen>([&](eset::Entity entity) { unfrozen++; });
+
+    std::vector<eset::Entity> entities = set.create_many<float, Frozen>(10, 1.0f, {});
+    eset::Entity plain = set.create();
+    set.insert<float>(plain, 2.0f);
+    set.insert<Selected, Frozen>(entities[0], {}, {});
+
+    //tags are only in the signature, and every entity shares their instance
+    bool test_return = set.get_raw<Frozen>(entities[0]) == set.get_raw<Frozen>(entities[1]) && set.get_raw<Frozen>(plain) == nullptr;
+    test_return = test_return && set.get_raw<Selected>(entities[0]) && !set.get_raw<Selected>(entities[1]);
+    for(eset::ArchetypeStats& archetype : set.stats().archetypes) {
+        test_return = test_return && archetype.column_count <= 1;
+    }
+
+    size_t count = 0;
+    for(auto [entity, number, frozen] : set.iterator<float, Frozen>()) {
+        test_return = test_return && number == 1.0f && &frozen == set.get_raw<Frozen>(entities[0]);
+        count++;
+    }
+    size_t selected = 0;
+    for(auto [entity, number, tag] : set.iterator<float, eset::Optional<Selected>>()) {
+        selected += tag != nullptr;
+    }
+    test_return = test_return && count == 10 && selected == 1;
+
+    //tags move with the entities, and can be added and removed like components
+    eset::CommandBuffer commands;
+    commands.insert<Selected>(plain, {});
+    commands.remove_component<Frozen>(entities[1]);
+    commands.flush(set);
+    set.remove_component<Selected>(entities[0]);
+    set.remove(entities[2]);
+    test_return = test_return && set.get_raw<Selected>(plain) && !set.get_raw<Frozen>(entities[1]) && !set.get_raw<Selected>(entities[0]);
+    test_return = test_return && *set.get_raw<float>(entities[0]) == 1.0f && *set.get_raw<float>(plain) == 2.0f && unfrozen == 2;
+
+    //and are saved and loaded
+    const char* path = "eset_tags_test.bin";
+    eset::Set loaded;
+    test_return = test_return && set.save(path) && loaded.load(path);
+    test_return = test_return && loaded.get_raw<Frozen>(entities[3]) && loaded.get_raw<Selected>(plain) && !loaded.get_raw<Frozen>(plain);
+    std::remove(path);
+    return test_return;
+}
+
+struct Time {
+    float delta;
+};
+
+bool test_resources() {
+
+    eset::Set set;
+    bool test_return = set.resource<Time>() == nullptr && !set.remove_resource<Time>();
+
+    //replacing a resource keeps it at the same address
+    Time& time = set.set_resource<Time>({0.5f});
+    set.set_resource<std::string>("config");
+    set.set_resource<Time>({0.25f});
+    test_return = test_return && set.resource<Time>() == &time && time.delta == 0.25f && *set.resource<std::string>() == "config";
+
+    //queries can read resources next to components, without needing an entity
+    std::vector<eset::Entity> entities = set.create_many<float>(10, 1.0f);
+    eset::Query<float, eset::Resource<Time>> query(set);
+    size_t count = 0;
+    for(auto [entity, number, resource] : query.iterator()) {
+        number += resource.delta;
+        count++;
+    }
+    test_return = test_return && count == 10 && *set.get_raw<float>(entities[3]) == 1.25f && set.stats().archetype_count == 2;
+
+    //a query with a missing resource gives nothing
+    test_return = test_return && set.remove_resource<Time>() && !set.resource<Time>();
+    count = 0;
+    for(auto [entity, number, resource] : set.iterator<float, eset::Resource<Time>>()) {
+        count++;
+    }
+    return test_return && count == 0;
+}
+
+struct SavedName {
+    std::string value;
+};
+
+void save_name(const SavedName& name, std::ostream& out) {
+    uint64_t size = name.value.size();
+    out.write((const char*)&size, sizeof(size));
+    out.write(name.value.data(), size);
+}
+
+bool load_name(std::istream& in, SavedName& name) {
+    uint64_t size = 0;
+    in.read((char*)&size, sizeof(size));
+    name.value.resize(size);
+    in.read(name.value.data(), size);
+    return in.good();
+}
+
+bool test_save_load() {
+
+    eset::Types::set_serializer<SavedName, save_name, load_name>();
+    const char* path = "eset_save_load_test.bin";
+
+    eset::Set saved;
+    std::vector<eset::Entity> entities;
+    for(size_t i = 0; i < 300; i++) {
+        eset::Entity entity = saved.create();
+        saved.insert<ChunkedComponent, int>(entity, {i}, (int)i);
+        if(i % 3 == 0) {
+            saved.insert<SavedName>(entity, {"entity " + std::to_string(i)});
+        }
+        entities.push_back(entity);
+    }
+    eset::Entity empty = saved.create();
+    saved.advance_tick();
+    saved.mark_changed<int>(entities[7]);
+    saved.remove(entities[1]);
+
+    bool test_return = saved.save(path);
+
+    //the loaded set has the same entities, components and ticks
+    eset::Set loaded;
+    test_return = test_return && loaded.load(path) && loaded.exist(empty) && !loaded.exist(entities[1]);
+    for(size_t i = 2; i < entities.size(); i++) {
+        eset::Entity entity = entities[i];
+        test_return = test_return && loaded.get_raw<ChunkedComponent>(entity)->value == i && *loaded.get_raw<int>(entity) == (int)i;
+        SavedName* name = loaded.get_raw<SavedName>(entity);
+        test_return = test_return && (i % 3 == 0 ? name && name->value == "entity " + std::to_string(i) : !name);
+    }
+    size_t changed = 0;
+    for(auto [entity, value] : loaded.iterator<int>().changed<int>(saved.current_tick() - 1)) {
+        test_return = test_return && entity == entities[7];
+        changed++;
+    }
+    test_return = test_return && changed == 1 && loaded.current_tick() == saved.current_tick();
+
+    //the removed index is reused with a newer generation, like it would have been in the saved set
+    eset::Entity reused = loaded.create();
+    test_return = test_return && eset::entity_index(reused) == eset::entity_index(entities[1]) && reused != entities[1];
+
+    //a set with entities, a missing file and a cut off file are refused
+    test_return = test_return && !loaded.load(path) && !eset::Set().load("eset_missing_file.bin");
+    std::ifstream in(path, std::ios::binary);
+    std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+    std::ofstream(path, std::ios::binary | std::ios::trunc).write(bytes.data(), bytes.size() / 2);
+    eset::Set cut;
+    test_return = test_return && !cut.load(path) && !cut.exist(entities[2]) && cut.create() == 1;
+
+    std::remove(path);
+    return test_return;
+}
+
 int main() {
 
     run_test(test_single_non_existing_removal, "Removing a nonexisting entity");
@@ -290,6 +1353,30 @@ int main() {
     run_test(test_reference_count, "Reference count");
     run_test(test_reference_set_pointer, "Reference set pointer");
     run_test(test_multiple_storage_references, "Multiple reference same storage");
+    run_test(test_archetype_transitions, "Archetype transitions");
+    run_test(test_remove_component, "Remove component");
+    run_test(test_lookup_after_removal, "Lookup after removal");
+    run_test(test_create_while_removing, "Create while removing");
+    run_test(test_entity_recycling, "Entity recycling");
+    run_test(test_create_many, "Create many");
+    run_test(test_multi_insert, "Insert multiple components");
+    run_test(test_chunked_storage, "Chunked storage");
+    run_test(test_each_chunk, "Iterate chunks");
+    run_test(test_parallel_iteration, "Parallel iteration");
+    run_test(test_query, "Persistent query");
+    run_test(test_many_archetypes_iteration, "Iterating many archetypes");
+    run_test(test_query_filters, "Query filters");
+    run_test(test_change_detection, "Change detection");
+    run_test(test_command_buffer, "Command buffer");
+    run_test(test_reference_pool, "Reference pool");
+    run_test(test_insert_many, "Insert into many entities");
+    run_test(test_type_registry, "Type registry");
+    run_test(test_wide_signatures, "Wide signatures");
+    run_test(test_stats, "Stats");
+    run_test(test_save_load, "Save and load");
+    run_test(test_observers, "Observers");
+    run_test(test_tags, "Tags");
+    run_test(test_resources, "Resources");
 
     //print all the results
     std::cout << "Tests: " << total << "; Passes: " << successes << "; Fails: " << fails << "\n";